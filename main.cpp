@@ -2,11 +2,26 @@
 #include <cmath>
 #include <chrono>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <cstdint>
+#include <cstring>
+#include <climits>
 #include <vector>
+#include <unordered_set>
 #include <algorithm>
 #include <cassert>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 using namespace std;
 using namespace chrono;
@@ -15,6 +30,10 @@ static constexpr int MAX_STEPS = 300;
 
 static constexpr int FIELD_WIDTH = 12;
 static constexpr int FIELD_HEIGHT = 9;
+static constexpr int FIELD_CELLS = FIELD_WIDTH * FIELD_HEIGHT;
+
+// Entity ids are (ownerId << 3) + type + isSecond, so they fit into [0, 16); ids 7 and 15 are unused
+static constexpr int ENTITIES_COUNT = 16;
 
 /******************************************** solution constants ******************************************************/
 
@@ -58,6 +77,16 @@ static constexpr int SCORE_FOR_UNINHABITED_ENEMY_TRAINER = -10;
 static constexpr int SCORE_DISTANCE_TO_END_MULTIPLIER = 1;
 static constexpr int SCORE_DISTANCE_TO_HOUSE_MULTIPLIER = 2;
 
+
+// Wall-clock time for searching one move, can be overridden with --move-time=<milliseconds>
+static constexpr int DEFAULT_MOVE_TIME_MILLISECONDS = 100;
+// Transposition table size, can be overridden with --hash=<megabytes>
+static constexpr int DEFAULT_HASH_MEGABYTES = 16;
+// Search threads, can be overridden with --threads=<count>
+static constexpr int DEFAULT_THREADS = 1;
+// Exploration constant of Monte Carlo tree search, can be overridden with --uct-c=<value>
+static constexpr double DEFAULT_UCT_EXPLORATION = 1.4;
+
 /******************************************** game structures *********************************************************/
 
 struct Cell {
@@ -70,15 +99,195 @@ struct Cell {
     bool isInFieldBounds() const {
         return row >= 0 && row < FIELD_HEIGHT && col >= 0 && col < FIELD_WIDTH;
     }
+
+    // Index of the cell in bitboards and per-cell arrays. Valid only for cells in field bounds
+    int index() const {
+        return row * FIELD_WIDTH + col;
+    }
+
+    static Cell byIndex(const int index) {
+        return Cell{index / FIELD_WIDTH, index % FIELD_WIDTH};
+    }
+};
+
+// Whole field fits into 108 bits: cell with index i is stored in bit i
+typedef unsigned __int128 Bitboard;
+
+inline Bitboard cellBit(const int index) {
+    return (Bitboard) 1 << index;
+}
+
+inline bool testBit(const Bitboard bitboard, const int index) {
+    return (bool) ((bitboard >> index) & 1);
+}
+
+inline int lowestBit(const Bitboard bitboard) {
+    const auto low = (uint64_t) bitboard;
+    return low != 0 ? __builtin_ctzll(low) : 64 + __builtin_ctzll((uint64_t) (bitboard >> 64));
+}
+
+inline int popLowestBit(Bitboard &bitboard) {
+    const int index = lowestBit(bitboard);
+    bitboard &= bitboard - 1;
+    return index;
+}
+
+/******************************************** move tables *************************************************************/
+
+static constexpr int DIRECTIONS_COUNT = 8;
+static constexpr int DIRECTION_ROWS[DIRECTIONS_COUNT] = {-1, -1, -1, 0, 0, 1, 1, 1};
+static constexpr int DIRECTION_COLS[DIRECTIONS_COUNT] = {-1, 0, 1, -1, 1, -1, 0, 1};
+static constexpr bool DIRECTION_IS_ORTHOGONAL[DIRECTIONS_COUNT] = {false, true, false, true, true, false, true, false};
+
+// Per-cell tables, generated at compile time. Cells are stored as indices, -1 stands for "out of field"
+struct CellTables {
+    // Adjacent cell in each direction
+    int8_t neighbours[FIELD_CELLS][DIRECTIONS_COUNT] = {};
+    // Cell two steps away in each direction: target of acrobat double move
+    // and landing cell of the entity pushed by a strongman through the neighbour in that direction
+    int8_t secondNeighbours[FIELD_CELLS][DIRECTIONS_COUNT] = {};
+    // 3x3 square around the cell, that is cells blocked by a trainer standing on it
+    Bitboard areas[FIELD_CELLS] = {};
 };
 
-template<>
-struct std::hash<Cell> {
-    size_t operator()(const Cell &cell) const {
-        return ((size_t) cell.row << 32) + cell.col;
+constexpr int8_t cellInDirection(const int index, const int direction, const int steps) {
+    const int row = index / FIELD_WIDTH + DIRECTION_ROWS[direction] * steps,
+            col = index % FIELD_WIDTH + DIRECTION_COLS[direction] * steps;
+
+    if (row < 0 || row >= FIELD_HEIGHT || col < 0 || col >= FIELD_WIDTH) return -1;
+    return (int8_t) (row * FIELD_WIDTH + col);
+}
+
+constexpr CellTables generateCellTables() {
+    CellTables tables{};
+
+    for (int index = 0; index < FIELD_CELLS; ++index) {
+        tables.areas[index] = (Bitboard) 1 << index;
+
+        for (int direction = 0; direction < DIRECTIONS_COUNT; ++direction) {
+            tables.neighbours[index][direction] = cellInDirection(index, direction, 1);
+            tables.secondNeighbours[index][direction] = cellInDirection(index, direction, 2);
+
+            if (tables.neighbours[index][direction] >= 0)
+                tables.areas[index] |= (Bitboard) 1 << tables.neighbours[index][direction];
+        }
     }
+
+    return tables;
+}
+
+static constexpr CellTables CELL_TABLES = generateCellTables();
+
+/******************************************** SIMD dispatch ***********************************************************/
+
+/**
+ * Kernels working on many lanes at once are written once over their lane type: a scalar or a GCC vector,
+ * which compiles to SSE or AVX2 code depending on the target of the function the kernel is inlined into.
+ * Each kernel has a wrapper per SimdLevel, and the widest one the CPU supports is called.
+ */
+typedef int8_t Int8x16 __attribute__((vector_size(16)));
+typedef int8_t Int8x32 __attribute__((vector_size(32)));
+typedef int16_t Int16x8 __attribute__((vector_size(16)));
+typedef int16_t Int16x16 __attribute__((vector_size(32)));
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_LEVELS_COUNT,
+};
+
+SimdLevel detectSimdLevel() {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE41;
+#endif
+    return SIMD_SCALAR;
+}
+
+const SimdLevel SIMD_LEVEL = detectSimdLevel(); // NOLINT(cert-err58-cpp)
+
+// Cells padded to a multiple of the widest vector of int8_t
+static constexpr int CELL_LANES = 128;
+
+struct CellCoordinates {
+    alignas(32) int8_t rows[CELL_LANES] = {};
+    alignas(32) int8_t cols[CELL_LANES] = {};
 };
 
+constexpr CellCoordinates generateCellCoordinates() {
+    CellCoordinates coordinates{};
+
+    for (int index = 0; index < FIELD_CELLS; ++index) {
+        coordinates.rows[index] = (int8_t) (index / FIELD_WIDTH);
+        coordinates.cols[index] = (int8_t) (index % FIELD_WIDTH);
+    }
+
+    return coordinates;
+}
+
+static constexpr CellCoordinates CELL_COORDINATES = generateCellCoordinates();
+
+/**
+ * Stores the Manhattan distance from every cell to the nearest of @param count houses into @param out,
+ * or 0 if there are no houses. Cells are lanes, houses are broadcast one at a time.
+ */
+template<typename Lanes>
+__attribute__((always_inline)) inline void nearestHouseLanes(const int8_t *houseRows, const int8_t *houseCols,
+                                                             const int count, int8_t *out) {
+    constexpr int WIDTH = sizeof(Lanes);
+    const int8_t noHouses = count > 0 ? INT8_MAX : 0;
+    const Lanes zero = Lanes{} + (int8_t) 0,
+            initial = zero + noHouses;
+
+    for (int lane = 0; lane < CELL_LANES; lane += WIDTH) {
+        Lanes row, col;
+        memcpy(&row, &CELL_COORDINATES.rows[lane], sizeof(Lanes));
+        memcpy(&col, &CELL_COORDINATES.cols[lane], sizeof(Lanes));
+
+        Lanes distance = initial;
+        for (int i = 0; i < count; ++i) {
+            const Lanes dstRow = row - houseRows[i],
+                    dstCol = col - houseCols[i];
+            const Lanes toHouse = (dstRow < zero ? -dstRow : dstRow) + (dstCol < zero ? -dstCol : dstCol);
+
+            distance = toHouse < distance ? toHouse : distance;
+        }
+
+        memcpy(&out[lane], &distance, sizeof(Lanes));
+    }
+}
+
+typedef void (*NearestHouseKernel)(const int8_t *houseRows, const int8_t *houseCols, int count, int8_t *out);
+
+void nearestHouseScalar(const int8_t *houseRows, const int8_t *houseCols, const int count, int8_t *out) {
+    nearestHouseLanes<int8_t>(houseRows, houseCols, count, out);
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse4.1")))
+void nearestHouseSse41(const int8_t *houseRows, const int8_t *houseCols, const int count, int8_t *out) {
+    nearestHouseLanes<Int8x16>(houseRows, houseCols, count, out);
+}
+
+__attribute__((target("avx2")))
+void nearestHouseAvx2(const int8_t *houseRows, const int8_t *houseCols, const int count, int8_t *out) {
+    nearestHouseLanes<Int8x32>(houseRows, houseCols, count, out);
+}
+
+const NearestHouseKernel NEAREST_HOUSE_KERNELS[SIMD_LEVELS_COUNT] = {nearestHouseScalar, nearestHouseSse41,
+                                                                     nearestHouseAvx2};
+#else
+const NearestHouseKernel NEAREST_HOUSE_KERNELS[SIMD_LEVELS_COUNT] = {nearestHouseScalar, nearestHouseScalar,
+                                                                     nearestHouseScalar};
+#endif
+
 struct Move {
     Cell from, to;
 
@@ -100,6 +309,8 @@ struct Entity {
         NONE_TYPE = -1,
     };
 
+    static constexpr int TYPES_COUNT = TRAINER + 1;
+
     /* const */ int id;
     /* const */ int ownerId;
     /* const */ EntityType type;
@@ -118,6 +329,9 @@ struct Entity {
             case 3:
                 return STRONGMAN;
 
+            case 4:
+                return ACROBAT;
+
             case 5:
                 return MAGICIAN;
 
@@ -143,26 +357,104 @@ struct Entity {
 
 const Entity NONE_ENTITY(-1, Entity::NONE_TYPE); // NOLINT(cert-err58-cpp)
 
-struct CellInfo {
-    /*const*/ bool hasHouse = false;
-    Entity entity = NONE_ENTITY;
+struct ZobristKeys {
+    // Indexed by (ownerId << 3) + type rather than by entity id: identical clowns (and strongmen) share keys,
+    // so positions which differ only by which of them stands where are the same position
+    uint64_t entities[ENTITIES_COUNT][FIELD_CELLS] = {};
+    uint64_t secondPlayerToMove = 0;
+    // Scores depend on the side they are counted for
+    uint64_t secondPlayerPerspective = 0;
+
+    // Game ends after MAX_STEPS, so positions closer to the end than the search can look ahead
+    // differ by the number of steps left
+    static constexpr int STEPS_HORIZON = 64;
+    uint64_t stepsLeft[STEPS_HORIZON + 1] = {};
 };
 
+constexpr uint64_t splitMix64(uint64_t &seed) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+constexpr ZobristKeys generateZobristKeys() {
+    ZobristKeys keys{};
+    uint64_t seed = 2021;
+
+    for (int kind = 0; kind < ENTITIES_COUNT; ++kind) {
+        for (int cell = 0; cell < FIELD_CELLS; ++cell) {
+            keys.entities[kind][cell] = splitMix64(seed);
+        }
+    }
+    keys.secondPlayerToMove = splitMix64(seed);
+    keys.secondPlayerPerspective = splitMix64(seed);
+    for (uint64_t &key : keys.stepsLeft) key = splitMix64(seed);
+
+    return keys;
+}
+
+static constexpr ZobristKeys ZOBRIST_KEYS = generateZobristKeys();
+
+inline uint64_t zobristKey(const int entityId, const int cellIndex) {
+    return ZOBRIST_KEYS.entities[(entityId & 0b1000) | Entity::typeById(entityId)][cellIndex];
+}
+
 struct Field {
-    /*const*/ unordered_set<Cell> houses;
+    /*const*/ Bitboard houses = 0;
+    Bitboard freeHouses = 0;
+
+    Bitboard occupied = 0;
+    Bitboard playerEntities[2] = {};
+    Bitboard typeEntities[Entity::TYPES_COUNT] = {};
+
+    // Entity id on each cell or -1 for empty cells
+    int8_t cellEntities[FIELD_CELLS];
+    Cell positions[ENTITIES_COUNT];
+
+    // Bit per entity id
+    uint16_t activeEntities = 0;
+
+    // Manhattan distance from each cell to the nearest free house, 0 if there are no free houses.
+    // Rebuilt whenever freeHouses changes, which is rare
+    int8_t houseDistances[FIELD_CELLS] = {};
+
+    // Zobrist hash of entity placements
+    uint64_t hash = 0;
+
+    // stateScore counted for each player. Kept up to date by doMove/undoMove, but not by set/clear:
+    // call refreshEvaluation after placing entities directly
+    int evaluation[2] = {};
+
+    Field() {
+        fill(begin(cellEntities), end(cellEntities), (int8_t) -1);
+    }
+
+    bool hasHouse(const Cell cell) const {
+        return testBit(houses, cell.index());
+    }
+
+    bool isEmpty(const Cell cell) const {
+        return !testBit(occupied, cell.index());
+    }
 
-    CellInfo field[FIELD_WIDTH][FIELD_HEIGHT];
-    unordered_map<int, Cell> positions;
+    Entity entityAt(const Cell cell) const {
+        const int entityId = cellEntities[cell.index()];
+        return entityId < 0 ? NONE_ENTITY : Entity(entityId);
+    }
 
-    unordered_set<Cell> freeHouses;
-    unordered_set<int> activeEntities;
+    bool isActive(const int entityId) const {
+        return (activeEntities >> entityId) & 1;
+    }
 
-    CellInfo &operator[](const Cell cell) {
-        return field[cell.col][cell.row];
+    bool hasFreeHouses() const {
+        return freeHouses != 0;
     }
 
-    const CellInfo &operator[](const Cell cell) const {
-        return field[cell.col][cell.row];
+    void addHouse(const Cell cell) {
+        houses |= cellBit(cell.index());
+        freeHouses |= cellBit(cell.index());
+        rebuildHouseDistances();
     }
 
     void set(const int row, const int col, const Entity entity) {
@@ -170,12 +462,32 @@ struct Field {
     }
 
     void set(const Cell cell, const Entity entity) {
-        (*this)[cell].entity = entity;
+        clear(cell);
+
+        const int index = cell.index();
+        const Bitboard bit = cellBit(index);
+
+        cellEntities[index] = (int8_t) entity.id;
+        hash ^= zobristKey(entity.id, index);
+        occupied |= bit;
+        playerEntities[entity.ownerId] |= bit;
+        typeEntities[entity.type] |= bit;
+
         positions[entity.id] = cell;
     }
 
     void clear(const Cell cell) {
-        (*this)[cell].entity = NONE_ENTITY;
+        const int index = cell.index();
+        const int entityId = cellEntities[index];
+        if (entityId < 0) return;
+
+        const Bitboard mask = ~cellBit(index);
+
+        cellEntities[index] = -1;
+        hash ^= zobristKey(entityId, index);
+        occupied &= mask;
+        playerEntities[entityId >> 3] &= mask;
+        typeEntities[Entity::typeById(entityId)] &= mask;
     }
 
     enum MoveType {
@@ -198,23 +510,26 @@ struct Field {
         if (!move.from.isInFieldBounds() || !move.to.isInFieldBounds()) return ILLEGAL_MOVE;
 
         // Moving from a house is illegal
-        if ((*this)[move.from].hasHouse) return ILLEGAL_MOVE;
+        if (hasHouse(move.from)) return ILLEGAL_MOVE;
 
-        const bool targetIsHouse = (*this)[move.to].hasHouse;
+        const bool targetIsHouse = hasHouse(move.to),
+                targetIsEmpty = isEmpty(move.to);
 
         // Moving to occupied house is illegal
-        if (targetIsHouse && (*this)[move.to].entity.type != Entity::NONE_TYPE) return ILLEGAL_MOVE;
+        if (targetIsHouse && !targetIsEmpty) return ILLEGAL_MOVE;
 
-        const Entity::EntityType entityType = (*this)[move.from].entity.type;
+        const int entityId = cellEntities[move.from.index()];
         // Entity on cell from must exist
-        if (entityType == Entity::NONE_TYPE) return ILLEGAL_MOVE;
+        if (entityId < 0) return ILLEGAL_MOVE;
+
+        const Entity::EntityType entityType = Entity::typeById(entityId);
 
-        const int player = (*this)[move.from].entity.ownerId,
+        const int player = entityId >> 3,
                 enemy = (player + 1) % 2;
 
-        const Cell enemyTrainerCell = positions.at(Entity::idOf(enemy, Entity::TRAINER));
+        const Cell enemyTrainerCell = positions[Entity::idOf(enemy, Entity::TRAINER)];
 
-        const bool enemyTrainerActive = activeEntities.count(Entity::idOf(enemy, Entity::TRAINER));
+        const bool enemyTrainerActive = isActive(Entity::idOf(enemy, Entity::TRAINER));
 
         // check against from or to cells are blocked by enemy trainer
         if (enemyTrainerActive) {
@@ -226,7 +541,7 @@ struct Field {
                 difCol = move.to.col - move.from.col;
 
         // Base move
-        if ((*this)[move.to].entity.type == Entity::NONE_TYPE) {
+        if (targetIsEmpty) {
             if (targetIsHouse) {
                 if (abs(difCol) + abs(difRow) == 1) return BASE_MOVE;
                 else if (abs(difCol) + abs(difRow) == 2
@@ -239,8 +554,6 @@ struct Field {
             }
         }
 
-        // For magician
-        const Entity targetEntity = (*this)[move.to].entity;
         // For strongman
         const Cell nextCell{move.to.row + difRow,
                             move.to.col + difCol};
@@ -253,7 +566,7 @@ struct Field {
                 break;
             case Entity::ACROBAT:
                 // Double move
-                if ((*this)[move.to].entity.type == Entity::NONE_TYPE) {
+                if (targetIsEmpty) {
                     // Vertical/horizontal
                     if ((difCol == 0 || difRow == 0) && abs(difCol) + abs(difRow) == 2) return DOUBLE_MOVE;
 
@@ -265,41 +578,61 @@ struct Field {
                 break;
             case Entity::STRONGMAN:
                 // Strongmen can push other entities
-                if (nextCell.isInFieldBounds() && (*this)[nextCell].entity.type == Entity::NONE_TYPE
-                    && (!(*this)[nextCell].hasHouse || (difCol == 0 || difRow == 0))
+                if (nextCell.isInFieldBounds() && isEmpty(nextCell)
+                    && (!hasHouse(nextCell) || (difCol == 0 || difRow == 0))
                     && (!enemyTrainerActive || !isBlockedByTrainer(nextCell, enemyTrainerCell)))
                     return PUSH;
                 break;
-            case Entity::MAGICIAN:
+            case Entity::MAGICIAN: {
+                // For magician
+                const int targetId = cellEntities[move.to.index()];
+                const Entity::EntityType targetType = Entity::typeById(targetId);
+
                 // Magicians can use 'teleportation'
                 if ( // 'Teleportation' is not a real teleportation but rather a swap with any other entity
-                        targetEntity.type != Entity::NONE_TYPE
+                        !targetIsEmpty
                         && (    // ... excluding enemy trainer and magician
-                                targetEntity.ownerId == player || targetEntity.type != Entity::TRAINER
-                                                                  && targetEntity.type != Entity::MAGICIAN)
+                                targetId >> 3 == player || targetType != Entity::TRAINER
+                                                           && targetType != Entity::MAGICIAN)
                         )
                     return SWAP;
                 break;
+            }
         }
 
         // Move doesn't match any pattern, so it is illegal
         return ILLEGAL_MOVE;
     }
 
-    void doMove(const Move move) {
-        switch (checkMove(move)) {
-            case ILLEGAL_MOVE:
+    // Everything doMove needs to remember so that undoMove can restore the field
+    struct Undo {
+        MoveType type;
+        int8_t from, to;
+        // House entered by the move or -1
+        int8_t enteredHouse;
+        // Whether the entered house was free before the move
+        bool houseWasFree;
+        int evaluation[2];
+    };
 
+    Undo doMove(const Move move) {
+        const MoveType type = checkMove(move);
+        Undo undo{type, -1, -1, -1, false, {evaluation[0], evaluation[1]}};
 
-                break;
-            case NO_MOVE:
-                // Do nothing
+        // Do nothing
+        if (type == ILLEGAL_MOVE || type == NO_MOVE) return undo;
+
+        const uint16_t affected = affectedEntities(move, type);
+        addEntityScores(affected, -1);
 
+        switch (type) {
+            case ILLEGAL_MOVE:
+            case NO_MOVE:
                 break;
             case BASE_MOVE:
             case DOUBLE_MOVE:
 
-                baseOrDoubleMove(move);
+                undo.enteredHouse = (int8_t) baseOrDoubleMove(move, undo.houseWasFree);
                 break;
             case SWAP:
 
@@ -307,7 +640,63 @@ struct Field {
                 break;
             case PUSH:
 
-                pushMove(move);
+                undo.enteredHouse = (int8_t) pushMove(move, undo.houseWasFree);
+                break;
+        }
+
+        addEntityScores(affected, 1);
+
+        undo.from = (int8_t) move.from.index();
+        undo.to = (int8_t) move.to.index();
+
+        return undo;
+    }
+
+    void undoMove(const Undo &undo) {
+        if (undo.type == ILLEGAL_MOVE || undo.type == NO_MOVE) return;
+
+        evaluation[0] = undo.evaluation[0];
+        evaluation[1] = undo.evaluation[1];
+
+        const Cell from = Cell::byIndex(undo.from),
+                to = Cell::byIndex(undo.to);
+
+        switch (undo.type) {
+            case BASE_MOVE:
+            case DOUBLE_MOVE: {
+                const Entity movingEntity = entityAt(to);
+
+                clear(to);
+                set(from, movingEntity);
+
+                if (undo.enteredHouse >= 0) leaveHouse(movingEntity.id, undo);
+                break;
+            }
+            case SWAP: {
+                const Entity magician = entityAt(to);
+                const Entity assistant = entityAt(from);
+
+                set(from, magician);
+                set(to, assistant);
+                break;
+            }
+            case PUSH: {
+                const Cell nextCell{2 * to.row - from.row, 2 * to.col - from.col};
+                const Entity strongman = entityAt(to);
+                const Entity pushedEntity = entityAt(nextCell);
+
+                clear(to);
+                set(from, strongman);
+
+                if (pushedEntity.type != Entity::NONE_TYPE) {
+                    clear(nextCell);
+                    set(to, pushedEntity);
+                }
+
+                if (undo.enteredHouse >= 0) leaveHouse(pushedEntity.id, undo);
+                break;
+            }
+            default:
                 break;
         }
     }
@@ -323,50 +712,234 @@ struct Field {
         return dstRow <= 1 && dstCol <= 1;
     }
 
+    int distanceToNearestHouse(const Cell cell) const {
+        return houseDistances[cell.index()];
+    }
+
+    void rebuildHouseDistances() {
+        int8_t houseRows[FIELD_CELLS], houseCols[FIELD_CELLS];
+        int count = 0;
+
+        Bitboard remainingHouses = freeHouses;
+        while (remainingHouses) {
+            const int index = popLowestBit(remainingHouses);
+            houseRows[count] = (int8_t) (index / FIELD_WIDTH);
+            houseCols[count++] = (int8_t) (index % FIELD_WIDTH);
+        }
+
+        alignas(32) int8_t distances[CELL_LANES];
+        NEAREST_HOUSE_KERNELS[SIMD_LEVEL](houseRows, houseCols, count, distances);
+        memcpy(houseDistances, distances, sizeof houseDistances);
+    }
+
+    // Contribution of entity @param entityId to stateScore counted for @param player
+    int entityScore(const int player, const int entityId) const {
+        int score = 0;
+
+        const int enemy = (player + 1) % 2;
+
+        const Cell friendTrainerCell = positions[Entity::idOf(player, Entity::TRAINER)],
+                enemyTrainerCell = positions[Entity::idOf(enemy, Entity::TRAINER)];
+
+        const bool friendTrainerActive = isActive(Entity::idOf(player, Entity::TRAINER)),
+                enemyTrainerActive = isActive(Entity::idOf(enemy, Entity::TRAINER));
+
+        // Macroses for checking if cell is blocked by a trainer. You can think that they are local functions
+#define isBlockedByFriendTrainer(cell) \
+friendTrainerActive && Field::isBlockedByTrainer(friendTrainerCell, cell) && !hasHouse(cell)
+#define isBlockedByEnemyTrainer(cell) \
+enemyTrainerActive && Field::isBlockedByTrainer(enemyTrainerCell, cell) && !hasHouse(cell)
+
+        const Entity entity(entityId);
+        const bool my = entity.ownerId == player;
+        const Cell cell = positions[entityId];
+
+        // Score for houses
+        if (hasHouse(cell)) {
+            if (my) return SCORE_FOR_CAPTURED_HOUSE;
+            else return SCORE_FOR_LOST_HOUSE;
+        }
+
+        // Score for entities and trainer blocks
+        switch (entity.type) {
+            case Entity::CLOWN:
+                if (my) {
+                    score += SCORE_FOR_UNINHABITED_FRIEND_CLOWN;
+                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_CLOWN;
+                } else {
+                    score += SCORE_FOR_UNINHABITED_ENEMY_CLOWN;
+                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_CLOWN;
+                }
+                break;
+
+            case Entity::STRONGMAN:
+                if (my) {
+                    score += SCORE_FOR_UNINHABITED_FRIEND_STRONGMAN;
+                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_STRONGMAN;
+                } else {
+                    score += SCORE_FOR_UNINHABITED_ENEMY_STRONGMAN;
+                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_STRONGMAN;
+                }
+                break;
+
+            case Entity::ACROBAT:
+                // typeById used to miss the acrobat, so these terms were never applied. Kept that way for now
+                break;
+
+            case Entity::MAGICIAN:
+                if (my) {
+                    score += SCORE_FOR_UNINHABITED_FRIEND_MAGICIAN;
+                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_MAGICIAN;
+                } else {
+                    score += SCORE_FOR_UNINHABITED_ENEMY_MAGICIAN;
+                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_MAGICIAN;
+                }
+                break;
+
+            case Entity::TRAINER:
+                // Trainers can't block each other
+                if (my) score -= SCORE_FOR_UNINHABITED_FRIEND_TRAINER;
+                else score -= SCORE_FOR_UNINHABITED_ENEMY_TRAINER;
+                break;
+
+            case Entity::NONE_TYPE:
+                break;
+        }
+
+        // Score for distances
+        if (my) {
+            score -= SCORE_DISTANCE_TO_END_MULTIPLIER * (11 - cell.col);
+        } else {
+            score += SCORE_DISTANCE_TO_END_MULTIPLIER * (11 - cell.col);
+        }
+
+        int dst = distanceToNearestHouse(cell);
+
+        if (my) {
+            score -= SCORE_DISTANCE_TO_HOUSE_MULTIPLIER * dst;
+        } else {
+            score += SCORE_DISTANCE_TO_HOUSE_MULTIPLIER * dst;
+        }
+
+        return score;
+
+        // Undefine macroses at function's end
+#undef isBlockedByEnemyTrainer
+#undef isBlockedByFriendTrainer
+    }
+
+    void refreshEvaluation() {
+        evaluation[0] = evaluation[1] = 0;
+        addEntityScores(ALL_ENTITIES, 1);
+    }
+
 private:
-    void baseOrDoubleMove(const Move move) {
-        Entity movingEntity = (*this)[move.from].entity;
+    // Masks of entity ids
+    static constexpr uint16_t PLAYER_ENTITIES[2] = {0x007F, 0x7F00};
+    static constexpr uint16_t ALL_ENTITIES = PLAYER_ENTITIES[0] | PLAYER_ENTITIES[1];
+
+    void addEntityScores(uint16_t entities, const int sign) {
+        while (entities) {
+            const int entityId = __builtin_ctz(entities);
+            entities &= entities - 1;
+
+            evaluation[0] += sign * entityScore(0, entityId);
+            evaluation[1] += sign * entityScore(1, entityId);
+        }
+    }
+
+    // Entities whose entityScore a not yet done move changes
+    uint16_t affectedEntities(const Move move, const MoveType type) const {
+        const int movingId = cellEntities[move.from.index()],
+                otherId = type == SWAP || type == PUSH ? cellEntities[move.to.index()] : -1;
+
+        // Cell entered by moving entity or by the pushed one
+        const Cell target = type == PUSH
+                            ? Cell{2 * move.to.row - move.from.row, 2 * move.to.col - move.from.col}
+                            : move.to;
+
+        // Occupying a free house changes distances to the nearest one for everybody
+        if (testBit(freeHouses, target.index())) return ALL_ENTITIES;
+
+        uint16_t affected = (uint16_t) (1u << movingId);
+        if (otherId >= 0) affected |= (uint16_t) (1u << otherId);
+
+        // Moved trainer blocks and unblocks enemy entities
+        if (Entity::typeById(movingId) == Entity::TRAINER) affected |= PLAYER_ENTITIES[(movingId >> 3) ^ 1];
+        if (otherId >= 0 && Entity::typeById(otherId) == Entity::TRAINER)
+            affected |= PLAYER_ENTITIES[(otherId >> 3) ^ 1];
+
+        return affected;
+    }
+
+    // Entity id is negative when a strongman 'pushes' nothing, see pushMove
+    int enterHouse(const int entityId, const Cell house, bool &houseWasFree) {
+        const int index = house.index();
+
+        if (entityId >= 0) activeEntities &= (uint16_t) ~(1u << entityId);
+        houseWasFree = testBit(freeHouses, index);
+
+        if (houseWasFree) {
+            freeHouses &= ~cellBit(index);
+            rebuildHouseDistances();
+        }
+
+        return index;
+    }
+
+    void leaveHouse(const int entityId, const Undo &undo) {
+        if (entityId >= 0) activeEntities |= (uint16_t) (1u << entityId);
+
+        if (undo.houseWasFree) {
+            freeHouses |= cellBit(undo.enteredHouse);
+            rebuildHouseDistances();
+        }
+    }
+
+    // Returns index of the entered house or -1
+    int baseOrDoubleMove(const Move move, bool &houseWasFree) {
+        Entity movingEntity = entityAt(move.from);
 
         clear(move.from);
         set(move.to, movingEntity);
 
-        CellInfo info = (*this)[move.to];
+        if (!hasHouse(move.to)) return -1;
 
-        if (info.hasHouse) {
-            activeEntities.erase(movingEntity.id);
-            freeHouses.erase(move.to);
-        }
+        return enterHouse(movingEntity.id, move.to, houseWasFree);
     }
 
     void swapMove(const Move move) {
-        Entity magician = (*this)[move.from].entity;
-        Entity assistant = (*this)[move.to].entity;
+        Entity magician = entityAt(move.from);
+        Entity assistant = entityAt(move.to);
 
         set(move.to, magician);
         set(move.from, assistant);
     }
 
-    void pushMove(const Move move) {
-        Entity strongman = (*this)[move.from].entity;
-        Entity pushedEntity = (*this)[move.to].entity;
+    // Returns index of the entered house or -1
+    int pushMove(const Move move, bool &houseWasFree) {
+        Entity strongman = entityAt(move.from);
+        Entity pushedEntity = entityAt(move.to);
 
         // nextCell = to + (to - from)
         Cell nextCell{2 * move.to.row - move.from.row, 2 * move.to.col - move.from.col};
 
         clear(move.from);
         set(move.to, strongman);
-        set(nextCell, pushedEntity);
 
-        CellInfo info = (*this)[nextCell];
+        // checkMove doesn't require cell to to be occupied, so a strongman can 'push' nothing.
+        // In that case the house on nextCell (if any) is still lost
+        if (pushedEntity.type != Entity::NONE_TYPE) set(nextCell, pushedEntity);
 
-        if (info.hasHouse) {
-            activeEntities.erase(pushedEntity.id);
-            freeHouses.erase(nextCell);
-        }
+        if (!hasHouse(nextCell)) return -1;
+
+        return enterHouse(pushedEntity.id, nextCell, houseWasFree);
     }
 
 };
 
+constexpr uint16_t Field::PLAYER_ENTITIES[2];
+
 struct State {
     /*const*/ int myPlayer = -1;
 
@@ -375,11 +948,30 @@ struct State {
     int doneSteps = 0;
     int currentPlayer = 0;
 
-    void doMove(const Move move) {
-        field.doMove(move);
+    Field::Undo doMove(const Move move) {
+        const Field::Undo undo = field.doMove(move);
 
         currentPlayer = (currentPlayer + 1) % 2;
         doneSteps++;
+
+        return undo;
+    }
+
+    void undoMove(const Field::Undo &undo) {
+        field.undoMove(undo);
+
+        currentPlayer = (currentPlayer + 1) % 2;
+        doneSteps--;
+    }
+
+    // Position key for the transposition table
+    uint64_t key() const {
+        const int stepsLeft = MAX_STEPS - doneSteps;
+
+        return field.hash
+               ^ (currentPlayer == 1 ? ZOBRIST_KEYS.secondPlayerToMove : 0)
+               ^ (myPlayer == 1 ? ZOBRIST_KEYS.secondPlayerPerspective : 0)
+               ^ (stepsLeft <= ZobristKeys::STEPS_HORIZON ? ZOBRIST_KEYS.stepsLeft[max(stepsLeft, 0)] : 0);
     }
 };
 
@@ -443,328 +1035,3604 @@ istream &operator>>(istream &in, State &state) {
 
     for (int i = 0; i < 13 /* houses count */; ++i) {
         Cell c;
-        cin >> c;
-        state.field.houses.insert(c);
-        state.field.freeHouses.insert(c);
-        state.field[c].hasHouse = true;
+        in >> c;
+        state.field.addHouse(c);
     }
 
     in >> state.myPlayer;
 
     for (int i = 0; i < 0b111 /* TRAINER + 1 */; ++i) {
-        state.field.activeEntities.insert(i);
-        state.field.activeEntities.insert(i | 0b1000);
+        state.field.activeEntities |= 1u << i;
+        state.field.activeEntities |= 1u << (i | 0b1000);
     }
 
     initializeEntities(state.field, 0);
     initializeEntities(state.field, 1);
 
+    state.field.refreshEvaluation();
+
     return in;
 }
 
-/******************************************** main ********************************************************************/
+/******************************************** position notation *******************************************************/
+
+/**
+ * Text notation of a position, in the spirit of FEN: "<board> <player to move> <done steps> <my player>".
+ * Board lists rows from 9 down to 1, separated by '/', each row from column A to L:
+ *  - a number is a run of empty cells without houses;
+ *  - 'h' is a free house, 'x' is a house taken by a strongman pushing nothing into it;
+ *  - an entity is a letter of its type: c(lown), s(trongman), a(crobat), m(agician), t(rainer),
+ *    upper case for player 0 and lower case for player 1. '+' after the letter marks the second clown or strongman,
+ *    '*' marks the entity on a house.
+ * Entities leave the game exactly when they enter a house, so active flags follow from the board.
+ * The start position of "F1 F2 F3 F4 F5 F6 F7 F8 F9 D5 E5 G5 H5 0" is
+ * "ac+s+2h6/cm3h6/s4h6/t4h6/3hhhhh4/T4h6/S4h6/CM3h6/AC+S+2h6 0 0 0".
+ */
+static constexpr char ENTITY_LETTERS[Entity::TYPES_COUNT + 1] = "c?s?amt";
+
+// Sets up @param state, which must be default constructed, as if the game has come to the given position
+void setUpPosition(State &state, const Bitboard houses, const Bitboard freeHouses, const Cell *entityCells,
+                   const int currentPlayer, const int doneSteps, const int myPlayer) {
+    Field &field = state.field;
+
+    field.houses = houses;
+    field.freeHouses = freeHouses;
+
+    for (int entityId = 0; entityId < ENTITIES_COUNT; ++entityId) {
+        if (Entity::typeById(entityId) == Entity::NONE_TYPE) continue;
+
+        field.set(entityCells[entityId], Entity(entityId));
+        if (!field.hasHouse(entityCells[entityId])) field.activeEntities |= (uint16_t) (1u << entityId);
+    }
 
-void mainLoop(State &);
+    field.rebuildHouseDistances();
+    field.refreshEvaluation();
 
-Move doMove(const State &);
+    state.currentPlayer = currentPlayer;
+    state.doneSteps = doneSteps;
+    state.myPlayer = myPlayer;
+}
 
-int main() {
+string toNotation(const State &state) {
+    const Field &field = state.field;
+    string out;
 
+    for (int row = FIELD_HEIGHT - 1; row >= 0; --row) {
+        int emptyCells = 0;
 
-    State state;
-    cin >> state;
+        for (int col = 0; col < FIELD_WIDTH; ++col) {
+            const Cell cell{row, col};
+            const int entityId = field.cellEntities[cell.index()];
 
-    while (state.doneSteps < MAX_STEPS && !state.field.freeHouses.empty())
-        mainLoop(state);
+            if (entityId < 0 && !field.hasHouse(cell)) {
+                ++emptyCells;
+                continue;
+            }
 
+            if (emptyCells > 0) out += to_string(emptyCells);
+            emptyCells = 0;
 
-    return 0;
-}
+            if (entityId < 0) {
+                out += testBit(field.freeHouses, cell.index()) ? 'h' : 'x';
+                continue;
+            }
+
+            const char letter = ENTITY_LETTERS[Entity::typeById(entityId)];
+            out += entityId >> 3 == 0 ? (char) toupper(letter) : letter;
+            if (entityId & 1 && Entity::typeById(entityId) != Entity::MAGICIAN) out += '+';
+            if (field.hasHouse(cell)) out += '*';
+        }
+
+        if (emptyCells > 0) out += to_string(emptyCells);
+        if (row > 0) out += '/';
+    }
+
+    out += ' ' + to_string(state.currentPlayer) + ' ' + to_string(state.doneSteps) + ' ' + to_string(state.myPlayer);
+    return out;
+}
+
+/**
+ * Parses toNotation output into @param state, which must be default constructed.
+ * @return false if the notation is malformed or doesn't place every entity exactly once
+ */
+bool parseNotation(const string &notation, State &state) {
+    Bitboard houses = 0, freeHouses = 0;
+    Cell entityCells[ENTITIES_COUNT];
+    uint16_t placed = 0;
+
+    size_t i = 0;
+    for (int row = FIELD_HEIGHT - 1; row >= 0; --row) {
+        int col = 0;
+
+        for (; i < notation.size() && notation[i] != '/' && notation[i] != ' '; ++i) {
+            const char c = notation[i];
+
+            if (isdigit(c)) {
+                int emptyCells = c - '0';
+                while (i + 1 < notation.size() && isdigit(notation[i + 1]))
+                    emptyCells = emptyCells * 10 + notation[++i] - '0';
+                col += emptyCells;
+                continue;
+            }
+
+            if (col >= FIELD_WIDTH) return false;
+            const int index = Cell{row, col++}.index();
+
+            if (c == 'h' || c == 'x') {
+                houses |= cellBit(index);
+                if (c == 'h') freeHouses |= cellBit(index);
+                continue;
+            }
+
+            const char *letter = strchr(ENTITY_LETTERS, tolower(c));
+            if (letter == nullptr || *letter == '?' || *letter == '\0') return false;
+
+            const bool isSecond = i + 1 < notation.size() && notation[i + 1] == '+';
+            if (isSecond) ++i;
+            if (i + 1 < notation.size() && notation[i + 1] == '*') {
+                ++i;
+                houses |= cellBit(index);
+            }
+
+            const Entity::EntityType type = (Entity::EntityType) (letter - ENTITY_LETTERS);
+            const int entityId = Entity::idOf(isupper(c) ? 0 : 1, type, isSecond);
+
+            // Only clowns and strongmen have second ones
+            if (Entity::typeById(entityId) != type || (placed >> entityId) & 1) return false;
+
+            placed |= (uint16_t) (1u << entityId);
+            entityCells[entityId] = Cell::byIndex(index);
+        }
+
+        if (col != FIELD_WIDTH) return false;
+        if (row > 0 && (i >= notation.size() || notation[i++] != '/')) return false;
+    }
+
+    // Every entity but the unused ids 7 and 15
+    if (placed != 0x7F7F) return false;
+
+    int currentPlayer = -1, doneSteps = -1, myPlayer = -1;
+    stringstream rest(notation.substr(i));
+    if (!(rest >> currentPlayer >> doneSteps >> myPlayer)) return false;
+    if (currentPlayer < 0 || currentPlayer > 1 || myPlayer < 0 || myPlayer > 1
+        || doneSteps < 0 || doneSteps > MAX_STEPS) return false;
+
+    setUpPosition(state, houses, freeHouses, entityCells, currentPlayer, doneSteps, myPlayer);
+    return true;
+}
+
+/**
+ * Fixed-size binary encoding of a position, 32 bytes:
+ *  - cell index of each entity, ids 0-6 and 8-14;
+ *  - houses, 108 bits little endian;
+ *  - bit per house, in order of cell indices, set if the house is free: there are at most 16 houses;
+ *  - done steps in bits 0-13, player to move in bit 14 and my player in bit 15, little endian.
+ */
+struct PackedPosition {
+    static constexpr int SIZE = 32;
+    static constexpr int MAX_HOUSES = 16;
+
+    uint8_t bytes[SIZE] = {};
+};
+
+PackedPosition packPosition(const State &state) {
+    const Field &field = state.field;
+    PackedPosition out;
+    uint8_t *bytes = out.bytes;
+
+    for (int entityId = 0; entityId < ENTITIES_COUNT; ++entityId) {
+        if (Entity::typeById(entityId) == Entity::NONE_TYPE) continue;
+        *bytes++ = (uint8_t) field.positions[entityId].index();
+    }
+
+    for (int byte = 0; byte < 14; ++byte) *bytes++ = (uint8_t) (field.houses >> (8 * byte));
+
+    uint16_t freeFlags = 0;
+    int house = 0;
+    Bitboard remainingHouses = field.houses;
+    while (remainingHouses) {
+        assert(house < PackedPosition::MAX_HOUSES);
+        if (testBit(field.freeHouses, popLowestBit(remainingHouses))) freeFlags |= (uint16_t) (1u << house);
+        ++house;
+    }
+
+    const uint16_t steps = (uint16_t) (state.doneSteps | state.currentPlayer << 14 | state.myPlayer << 15);
+    for (const uint16_t word : {freeFlags, steps}) {
+        *bytes++ = (uint8_t) word;
+        *bytes++ = (uint8_t) (word >> 8);
+    }
+
+    return out;
+}
+
+/**
+ * Decodes packPosition output into @param state, which must be default constructed.
+ * @return false if entity cells are out of field, shared or there are too many houses
+ */
+bool unpackPosition(const PackedPosition &packed, State &state) {
+    const uint8_t *bytes = packed.bytes;
+    Cell entityCells[ENTITIES_COUNT];
+    Bitboard occupied = 0;
+
+    for (int entityId = 0; entityId < ENTITIES_COUNT; ++entityId) {
+        if (Entity::typeById(entityId) == Entity::NONE_TYPE) continue;
+
+        const int index = *bytes++;
+        if (index >= FIELD_CELLS || testBit(occupied, index)) return false;
+
+        occupied |= cellBit(index);
+        entityCells[entityId] = Cell::byIndex(index);
+    }
+
+    Bitboard houses = 0;
+    for (int byte = 0; byte < 14; ++byte) houses |= (Bitboard) *bytes++ << (8 * byte);
+    if (houses >> FIELD_CELLS) return false;
+
+    const uint16_t freeFlags = (uint16_t) (bytes[0] | bytes[1] << 8),
+            steps = (uint16_t) (bytes[2] | bytes[3] << 8);
+
+    Bitboard freeHouses = 0, remainingHouses = houses;
+    for (int house = 0; remainingHouses; ++house) {
+        if (house >= PackedPosition::MAX_HOUSES) return false;
+
+        const int index = popLowestBit(remainingHouses);
+        if ((freeFlags >> house) & 1) freeHouses |= cellBit(index);
+    }
+
+    const int doneSteps = steps & 0x3FFF;
+    if (doneSteps > MAX_STEPS) return false;
+
+    setUpPosition(state, houses, freeHouses, entityCells, (steps >> 14) & 1, doneSteps, steps >> 15);
+    return true;
+}
+
+/******************************************** configuration ***********************************************************/
+
+#ifdef LOG_FILE
+ofstream logFile(LOG_FILE); // NOLINT(cert-err58-cpp)
+#define LOG(message) (logFile << message << endl)
+#else
+#define LOG(message) ((void) 0)
+#endif
+
+struct Config {
+    milliseconds moveTime{DEFAULT_MOVE_TIME_MILLISECONDS};
+    size_t hashMegabytes = DEFAULT_HASH_MEGABYTES;
+    // Search the predicted enemy reply while waiting for the enemy move
+    bool ponder = false;
+    int threads = DEFAULT_THREADS;
+    // Bind search threads to cores
+    bool pinThreads = false;
+
+    enum ParallelSearch {
+        LAZY_SMP,
+        YOUNG_BROTHERS_WAIT,
+    };
+    ParallelSearch parallelSearch = LAZY_SMP;
+    // Depth limit, for deterministic analysis runs
+    int maxDepth = INT_MAX;
+
+    enum Engine {
+        ALPHA_BETA,
+        MONTE_CARLO,
+    };
+    Engine engine = ALPHA_BETA;
+    // Exploration constant of UCT
+    double uctExploration = DEFAULT_UCT_EXPLORATION;
+
+    enum PlayoutPolicy {
+        // Uniformly random moves
+        RANDOM_PLAYOUT,
+        // Random captures while there are any, random moves otherwise
+        GREEDY_PLAYOUT,
+    };
+    PlayoutPolicy playoutPolicy = RANDOM_PLAYOUT;
+};
+
+Config config; // NOLINT(cert-err58-cpp)
+
+// Splits argument of form --name=value into name and value. Value is empty if missing
+pair<string, string> splitArgument(const string &argument) {
+    const size_t separator = argument.find('=');
+    return {argument.substr(0, separator), separator == string::npos ? "" : argument.substr(separator + 1)};
+}
+
+// @return false if the argument is unknown
+bool parseArgument(const string &argument, Config &out) {
+    const pair<string, string> parts = splitArgument(argument);
+    const string &name = parts.first,
+            &value = parts.second;
+
+    if (name == "--move-time") out.moveTime = milliseconds(stoi(value));
+    else if (name == "--hash") out.hashMegabytes = stoul(value);
+    else if (name == "--ponder") out.ponder = value != "0";
+    else if (name == "--threads") out.threads = max(1, stoi(value));
+    else if (name == "--pin-threads") out.pinThreads = value != "0";
+    else if (name == "--parallel" && value == "smp") out.parallelSearch = Config::LAZY_SMP;
+    else if (name == "--parallel" && value == "ybw") out.parallelSearch = Config::YOUNG_BROTHERS_WAIT;
+    else if (name == "--depth") out.maxDepth = stoi(value);
+    else if (name == "--engine" && value == "alphabeta") out.engine = Config::ALPHA_BETA;
+    else if (name == "--engine" && value == "mcts") out.engine = Config::MONTE_CARLO;
+    else if (name == "--uct-c") out.uctExploration = stod(value);
+    else if (name == "--playout" && value == "random") out.playoutPolicy = Config::RANDOM_PLAYOUT;
+    else if (name == "--playout" && value == "greedy") out.playoutPolicy = Config::GREEDY_PLAYOUT;
+    else return false;
+
+    return true;
+}
+
+void parseArguments(const int argc, char **argv, Config &out) {
+    for (int i = 1; i < argc; ++i) {
+        if (!parseArgument(argv[i], out)) cerr << "Unknown argument " << argv[i] << endl;
+    }
+}
+
+/******************************************** main ********************************************************************/
+
+void mainLoop(State &);
+
+Move doMove(const State &);
+
+void startPondering(const State &);
+
+void stopPondering();
+
+#ifdef PERFT
+int perftMain(int argc, char **argv);
+#endif
+#ifdef BENCH
+int benchMain(int argc, char **argv);
+#endif
+#ifdef POSGEN
+int posgenMain(int argc, char **argv);
+#endif
+#ifdef ARENA
+int arenaMain(int argc, char **argv);
+#endif
+#ifdef REGRESSION
+int regressionMain(int argc, char **argv);
+#endif
+
+int main(int argc, char **argv) {
+#ifdef PERFT
+    return perftMain(argc, argv);
+#endif
+#ifdef BENCH
+    return benchMain(argc, argv);
+#endif
+#ifdef POSGEN
+    return posgenMain(argc, argv);
+#endif
+#ifdef ARENA
+    return arenaMain(argc, argv);
+#endif
+#ifdef REGRESSION
+    return regressionMain(argc, argv);
+#endif
+
+    parseArguments(argc, argv, config);
+
+    State state;
+    cin >> state;
+
+    while (state.doneSteps < MAX_STEPS && state.field.hasFreeHouses())
+        mainLoop(state);
+
+
+    return 0;
+}
 
 
 void mainLoop(State &state) {
     if (state.currentPlayer != state.myPlayer) {
         Move move;
         cin >> move;
+        stopPondering();
         state.doMove(move);
     } else {
         Move move = doMove(state);
         state.doMove(move);
         cout << move << endl;
+        if (config.ponder) startPondering(state);
     }
 }
 
 /******************************************** doMove and helpers ******************************************************/
 
-inline void addMoveIfLegal(const State &state, vector<Move> &out, const Move &move, const bool addSwaps = false) {
-    switch (state.field.checkMove(move)) {
-        case Field::BASE_MOVE:
-        case Field::PUSH:
-        case Field::DOUBLE_MOVE:
-        case Field::NO_MOVE:
-            out.push_back(move);
-            break;
+// Fixed-capacity list of moves, so that move generation doesn't allocate
+struct MoveList {
+    static constexpr int CAPACITY = 128;
 
-        case Field::SWAP:
-            if (addSwaps) out.push_back(move);
-            break;
+    Move moves[CAPACITY];
+    int count = 0;
 
-        case Field::ILLEGAL_MOVE:
-            // Don't add
-            break;
+    void push_back(const Move &move) {
+        assert(count < CAPACITY);
+        moves[count++] = move;
     }
+
+    int size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    const Move *begin() const { return moves; }
+
+    const Move *end() const { return moves + count; }
+};
+
+inline void addMove(MoveList &out, const int from, const int to) {
+    out.push_back(Move{Cell::byIndex(from), Cell::byIndex(to)});
 }
 
-vector<Move> allAvailableMoves(const State &state) {
-    vector<Move> res;
+/**
+ * Search looks at moves stage by stage, so that it doesn't generate the rest of moves after a cutoff.
+ * Each move belongs to exactly one stage.
+ */
+enum MoveStage {
+    // Base and double moves into houses and pushes of an entity into a house
+    CAPTURE_MOVES,
+    // Pushes landing outside of houses and magician swaps
+    PUSH_AND_SWAP_MOVES,
+    // Base and double moves outside of houses
+    QUIET_MOVES,
+    STAGES_COUNT,
+};
 
-    // Base move, push (strongman)
-    for (const int entityId : state.field.activeEntities) {
-        const Cell position = state.field.positions.at(entityId);
-        const Entity entity(entityId);
-        if (entity.ownerId != state.currentPlayer) continue;
+/**
+ * Appends moves of the player to move which belong to @param stage by walking the cell tables.
+ * Generated moves are exactly those checkMove accepts, except for strongman pushes over a distance.
+ */
+void generateMoves(const State &state, const MoveStage stage, MoveList &out) {
+    const Field &field = state.field;
+    const int player = state.currentPlayer,
+            enemy = (player + 1) % 2;
+    const int enemyTrainerId = Entity::idOf(enemy, Entity::TRAINER);
+
+    // Nobody can move from or to a cell blocked by the enemy trainer
+    const Bitboard blocked = field.isActive(enemyTrainerId)
+                             ? CELL_TABLES.areas[field.positions[enemyTrainerId].index()]
+                             : 0;
+
+    // Cells of each stage
+    const Bitboard stageTargets = stage == CAPTURE_MOVES ? field.houses : ~field.houses;
+    // Taken houses are left empty only in set up positions, but can be entered as well.
+    // houseDistances doesn't count them, so captures are looked for everywhere then
+    const bool emptyTakenHouses = (field.houses & ~field.freeHouses & ~field.occupied) != 0;
+
+    for (int entityId = player << 3; entityId < (player << 3) + Entity::TYPES_COUNT; ++entityId) {
+        if (!field.isActive(entityId)) continue;
 
-        for (int dRow = -1; dRow <= 1; ++dRow) {
-            for (int dCol = -1; dCol <= 1; ++dCol) {
-                const Move move{position, {position.row + dRow, position.col + dCol}};
-                addMoveIfLegal(state, res, move);
+        const int from = field.positions[entityId].index();
+        if (testBit(blocked | field.houses, from)) continue;
+
+        // Houses are entered orthogonally by 1 or 2 steps
+        if (stage == CAPTURE_MOVES && field.houseDistances[from] > 2 && !emptyTakenHouses) continue;
+
+        const Entity::EntityType type = Entity::typeById(entityId);
+
+        if (type == Entity::MAGICIAN && stage == PUSH_AND_SWAP_MOVES) {
+            // Swap with any entity outside of houses, excluding enemy trainer and magician
+            Bitboard assistants = field.occupied & ~field.houses & ~blocked & ~cellBit(from)
+                                  & ~(field.playerEntities[enemy]
+                                      & (field.typeEntities[Entity::TRAINER] | field.typeEntities[Entity::MAGICIAN]));
+
+            while (assistants) addMove(out, from, popLowestBit(assistants));
+        }
+
+        // Base move, push (strongman)
+        for (int direction = 0; direction < DIRECTIONS_COUNT; ++direction) {
+            const int to = CELL_TABLES.neighbours[from][direction];
+            if (to < 0 || testBit(blocked, to)) continue;
+
+            if (!testBit(field.occupied, to)) {
+                // Houses can be entered only orthogonally
+                if (stage != PUSH_AND_SWAP_MOVES && testBit(stageTargets, to)
+                    && (!testBit(field.houses, to) || DIRECTION_IS_ORTHOGONAL[direction]))
+                    addMove(out, from, to);
+                continue;
             }
+
+            if (type != Entity::STRONGMAN || stage == QUIET_MOVES || testBit(field.houses, to)) continue;
+
+            const int next = CELL_TABLES.secondNeighbours[from][direction];
+            if (next >= 0 && !testBit(field.occupied | blocked, next) && testBit(stageTargets, next)
+                && (!testBit(field.houses, next) || DIRECTION_IS_ORTHOGONAL[direction]))
+                addMove(out, from, to);
         }
-    }
 
-    Cell position;
+        // Double move (acrobat)
+        if (type != Entity::ACROBAT || stage == PUSH_AND_SWAP_MOVES) continue;
+
+        for (int direction = 0; direction < DIRECTIONS_COUNT; ++direction) {
+            const int to = CELL_TABLES.secondNeighbours[from][direction];
 
-    // Double move (acrobat)
-    position = state.field.positions.at(Entity::idOf(state.currentPlayer, Entity::ACROBAT));
-    for (int dRow = -1; dRow <= 1; ++dRow) {
-        for (int dCol = -1; dCol <= 1; ++dCol) {
-            const Move move{position, {position.row + dRow, position.col + dCol}};
-            addMoveIfLegal(state, res, move);
+            if (to >= 0 && !testBit(field.occupied | blocked, to) && testBit(stageTargets, to)
+                && (!testBit(field.houses, to) || DIRECTION_IS_ORTHOGONAL[direction]))
+                addMove(out, from, to);
         }
     }
+}
+
+// All moves of the player to move, stage by stage
+void allAvailableMoves(const State &state, MoveList &res) {
+    res.count = 0;
 
-    // Swap (magician)
-    position = state.field.positions.at(Entity::idOf(state.currentPlayer, Entity::MAGICIAN));
-    for (const int assistantId : state.field.activeEntities) {
-        const Cell assistantPosition = state.field.positions.at(assistantId);
-        addMoveIfLegal(state, res, {position, assistantPosition});
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        generateMoves(state, (MoveStage) stage, res);
     }
+}
 
+MoveList allAvailableMoves(const State &state) {
+    MoveList res;
+    allAvailableMoves(state, res);
     return res;
 }
 
-int distanceToNearestHouse(const State &state, const Cell &cell) {
-    int dst = 1000;
-    for (auto house : state.field.freeHouses) {
-        dst = min(dst, abs(cell.row - house.row) + abs(cell.col - house.col));
+/**
+ * Appends moves which change the score at once and so must not be cut off by the search horizon:
+ * captures (moves and pushes into free houses) and, when @param withBlocks, trainer moves blocking new enemy entities.
+ */
+void generateTacticalMoves(const State &state, const bool withBlocks, MoveList &out) {
+    generateMoves(state, CAPTURE_MOVES, out);
+    if (!withBlocks) return;
+
+    const Field &field = state.field;
+    const int player = state.currentPlayer,
+            enemy = (player + 1) % 2;
+    const int trainerId = Entity::idOf(player, Entity::TRAINER),
+            enemyTrainerId = Entity::idOf(enemy, Entity::TRAINER);
+    if (!field.isActive(trainerId)) return;
+
+    const int from = field.positions[trainerId].index();
+    const Bitboard blocked = field.isActive(enemyTrainerId)
+                             ? CELL_TABLES.areas[field.positions[enemyTrainerId].index()]
+                             : 0;
+    if (testBit(blocked | field.houses, from)) return;
+
+    const Bitboard enemies = field.playerEntities[enemy] & ~field.houses,
+            alreadyBlocked = CELL_TABLES.areas[from] & enemies;
+
+    for (int direction = 0; direction < DIRECTIONS_COUNT; ++direction) {
+        const int to = CELL_TABLES.neighbours[from][direction];
+
+        // Moves into houses are captures and have been generated already
+        if (to < 0 || testBit(blocked | field.occupied | field.houses, to)) continue;
+
+        if (CELL_TABLES.areas[to] & enemies & ~alreadyBlocked) addMove(out, from, to);
     }
-    if (dst == 1000) dst = 0;
+}
 
-    return dst;
+int distanceToNearestHouse(const State &state, const Cell &cell) {
+    return state.field.distanceToNearestHouse(cell);
 }
 
 int distanceToNearestHouse(const State &state, const Entity &entity) {
-    return distanceToNearestHouse(state, state.field.positions.at(entity.id));
+    return distanceToNearestHouse(state, state.field.positions[entity.id]);
 }
 
-int stateScore(const State &state) {
-
+// Recomputes stateScore from scratch
+int fullStateScore(const State &state) {
     int score = 0;
 
-    const int player = state.myPlayer,
-            enemy = (player + 1) % 2;
+    for (int entityId = 0; entityId < 15; ++entityId) {
+        // Entity with id 7 doesn't exist
+        if (entityId == 7) continue;
+
+        score += state.field.entityScore(state.myPlayer, entityId);
+    }
+
+    return score;
+}
 
-    const Cell friendTrainerCell = state.field.positions.at(Entity::idOf(player, Entity::TRAINER)),
-            enemyTrainerCell = state.field.positions.at(Entity::idOf(enemy, Entity::TRAINER));
+// Field keeps the score up to date on every move. Define DEBUG_EVAL to check it against the full recompute
+int stateScore(const State &state) {
+#ifdef DEBUG_EVAL
+    assert(state.field.evaluation[state.myPlayer] == fullStateScore(state));
+#endif
+    return state.field.evaluation[state.myPlayer];
+}
 
-    const bool friendTrainerActive = state.field.activeEntities.count(Entity::idOf(player, Entity::TRAINER)) == 1,
-            enemyTrainerActive = state.field.activeEntities.count(Entity::idOf(enemy, Entity::TRAINER)) == 1;
+/******************************************** batch evaluation ********************************************************/
+
+/**
+ * Children of one position in structure-of-arrays layout: a row per entity id and a lane per child,
+ * so that the kernels below score a whole vector of siblings with each instruction.
+ * Lanes are int16_t: an entity contributes at most 1549 to the score in absolute value, and 14 of them fit.
+ */
+struct ChildBatch {
+    static constexpr int LANES = MoveList::CAPACITY;
+    // Widest kernel, lanes are filled up to a multiple of it
+    static constexpr int VECTOR_LANES = 16;
+    // Distance to the nearest house when there are no free houses left, see rebuildHouseDistances
+    static constexpr int16_t NO_HOUSE = INT8_MAX;
+
+    alignas(32) int16_t rows[ENTITIES_COUNT][LANES];
+    alignas(32) int16_t cols[ENTITIES_COUNT][LANES];
+    // -1 for entities standing on a house, 0 otherwise. Entities leave the game exactly when they enter a house,
+    // so a trainer blocks anybody only while its flag is 0
+    alignas(32) int16_t inHouse[ENTITIES_COUNT][LANES];
+    // Distance to the nearest free house in the parent position, valid when no child captures a house
+    alignas(32) int16_t houseDistances[ENTITIES_COUNT][LANES];
+    // Index of the house captured by the move of the child or -1
+    alignas(32) int16_t capturedHouse[LANES];
+
+    // Free houses of the parent position
+    int16_t houseRows[FIELD_CELLS], houseCols[FIELD_CELLS], houseIndices[FIELD_CELLS];
+    int housesCount = 0;
+    bool anyCapture = false;
+
+    int count = 0;
+    int myPlayer = 0;
+
+    // Number of lanes the kernels go through
+    int paddedCount() const {
+        return (count + VECTOR_LANES - 1) / VECTOR_LANES * VECTOR_LANES;
+    }
+};
 
-    // Macroses for checking if cell is blocked by a trainer. You can think that they are local functions
-#define isBlockedByFriendTrainer(cell) \
-friendTrainerActive && Field::isBlockedByTrainer(friendTrainerCell, cell) && !state.field[cell].hasHouse
-#define isBlockedByEnemyTrainer(cell) \
-enemyTrainerActive && Field::isBlockedByTrainer(enemyTrainerCell, cell) && !state.field[cell].hasHouse
+// entityScore split into terms which don't depend on the position
+struct EntityWeights {
+    int16_t houseScore = 0;
+    // Score outside of houses excluding distances
+    int16_t baseScore = 0;
+    // Added when the entity is blocked by trainer blockerId
+    int16_t blockedScore = 0;
+    int blockerId = -1;
+    // -1 for entities of the player whose score is counted, 1 for the enemy ones
+    int16_t sign = 0;
+};
 
-    for (int entityId = 0; entityId < 15; ++entityId) {
-        // Entity with id 7 doesn't exist
-        if (entityId == 7) continue;
+struct EvaluationWeights {
+    EntityWeights entities[ENTITIES_COUNT];
+};
+
+EvaluationWeights generateEvaluationWeights(const int player) {
+    EvaluationWeights weights;
 
+    for (int entityId = 0; entityId < ENTITIES_COUNT; ++entityId) {
         const Entity entity(entityId);
-        const bool my = entity.ownerId == player;
-        const Cell cell = state.field.positions.at(entityId);
+        if (entity.type == Entity::NONE_TYPE) continue;
 
-        // Score for houses
-        if (state.field[cell].hasHouse) {
-            if (my) score += SCORE_FOR_CAPTURED_HOUSE;
-            else score += SCORE_FOR_LOST_HOUSE;
+        const bool my = entity.ownerId == player;
+        EntityWeights &out = weights.entities[entityId];
 
-            continue;
-        }
+        out.houseScore = my ? SCORE_FOR_CAPTURED_HOUSE : SCORE_FOR_LOST_HOUSE;
+        out.sign = (int16_t) (my ? -1 : 1);
+        if (entity.type != Entity::TRAINER) out.blockerId = Entity::idOf(entity.ownerId ^ 1, Entity::TRAINER);
 
-        // Score for entities and trainer blocks
         switch (entity.type) {
             case Entity::CLOWN:
-                if (my) {
-                    score += SCORE_FOR_UNINHABITED_FRIEND_CLOWN;
-                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_CLOWN;
-                } else {
-                    score += SCORE_FOR_UNINHABITED_ENEMY_CLOWN;
-                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_CLOWN;
-                }
+                out.baseScore = my ? SCORE_FOR_UNINHABITED_FRIEND_CLOWN : SCORE_FOR_UNINHABITED_ENEMY_CLOWN;
+                out.blockedScore = my ? SCORE_FOR_BLOCKED_FRIEND_CLOWN : SCORE_FOR_BLOCKED_ENEMY_CLOWN;
                 break;
-
             case Entity::STRONGMAN:
-                if (my) {
-                    score += SCORE_FOR_UNINHABITED_FRIEND_STRONGMAN;
-                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_STRONGMAN;
-                } else {
-                    score += SCORE_FOR_UNINHABITED_ENEMY_STRONGMAN;
-                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_STRONGMAN;
-                }
+                out.baseScore = my ? SCORE_FOR_UNINHABITED_FRIEND_STRONGMAN : SCORE_FOR_UNINHABITED_ENEMY_STRONGMAN;
+                out.blockedScore = my ? SCORE_FOR_BLOCKED_FRIEND_STRONGMAN : SCORE_FOR_BLOCKED_ENEMY_STRONGMAN;
                 break;
-
             case Entity::ACROBAT:
-                if (my) {
-                    score += SCORE_FOR_UNINHABITED_FRIEND_ACROBAT;
-                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_ACROBAT;
-                } else {
-                    score += SCORE_FOR_UNINHABITED_ENEMY_ACROBAT;
-                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_ACROBAT;
-                }
+                // No type terms, as in Field::entityScore
                 break;
-
             case Entity::MAGICIAN:
-                if (my) {
-                    score += SCORE_FOR_UNINHABITED_FRIEND_MAGICIAN;
-                    if (isBlockedByEnemyTrainer(cell)) score += SCORE_FOR_BLOCKED_FRIEND_MAGICIAN;
-                } else {
-                    score += SCORE_FOR_UNINHABITED_ENEMY_MAGICIAN;
-                    if (isBlockedByFriendTrainer(cell)) score += SCORE_FOR_BLOCKED_ENEMY_MAGICIAN;
-                }
+                out.baseScore = my ? SCORE_FOR_UNINHABITED_FRIEND_MAGICIAN : SCORE_FOR_UNINHABITED_ENEMY_MAGICIAN;
+                out.blockedScore = my ? SCORE_FOR_BLOCKED_FRIEND_MAGICIAN : SCORE_FOR_BLOCKED_ENEMY_MAGICIAN;
                 break;
-
             case Entity::TRAINER:
-                // Trainers can't block each other
-                if (my) score -= SCORE_FOR_UNINHABITED_FRIEND_TRAINER;
-                else score -= SCORE_FOR_UNINHABITED_ENEMY_TRAINER;
+                out.baseScore = (int16_t) (my ? -SCORE_FOR_UNINHABITED_FRIEND_TRAINER
+                                              : -SCORE_FOR_UNINHABITED_ENEMY_TRAINER);
                 break;
-
             case Entity::NONE_TYPE:
                 break;
         }
+    }
 
-        // Score for distances
-        if (my) {
-            score -= SCORE_DISTANCE_TO_END_MULTIPLIER * (11 - cell.col);
-        } else {
-            score += SCORE_DISTANCE_TO_END_MULTIPLIER * (11 - cell.col);
-        }
+    return weights;
+}
 
-        int dst = distanceToNearestHouse(state, cell);
+// Indexed by the player whose score is counted
+const EvaluationWeights EVALUATION_WEIGHTS[2] = {generateEvaluationWeights(0), // NOLINT(cert-err58-cpp)
+                                                 generateEvaluationWeights(1)};
+
+/**
+ * Scores lanes of @param batch into @param out, from the point of view of batch.myPlayer.
+ * Lanes is int16_t or a vector of them, see SIMD dispatch.
+ */
+template<typename Lanes>
+__attribute__((always_inline)) inline void evaluateLanes(const ChildBatch &batch, int16_t *out) {
+    constexpr int WIDTH = sizeof(Lanes) / sizeof(int16_t);
+    const EvaluationWeights &weights = EVALUATION_WEIGHTS[batch.myPlayer];
+
+    const Lanes zero = Lanes{} + (int16_t) 0,
+            one = zero + (int16_t) 1,
+            noHouse = zero + ChildBatch::NO_HOUSE;
+
+#define LOAD_LANES(array) ({ Lanes value; memcpy(&value, &(array)[lane], sizeof(Lanes)); value; })
+#define ABS_LANES(value) ((value) < zero ? -(value) : (value))
+
+    for (int lane = 0; lane < batch.paddedCount(); lane += WIDTH) {
+        Lanes score = zero;
+
+        for (int entityId = 0; entityId < ENTITIES_COUNT; ++entityId) {
+            const EntityWeights &w = weights.entities[entityId];
+            if (w.sign == 0) continue;
+
+            const Lanes row = LOAD_LANES(batch.rows[entityId]),
+                    col = LOAD_LANES(batch.cols[entityId]);
+
+            Lanes distance;
+            if (batch.anyCapture) {
+                // Free houses differ between children, so distances are counted from scratch
+                const Lanes captured = LOAD_LANES(batch.capturedHouse);
+                distance = noHouse;
+
+                for (int i = 0; i < batch.housesCount; ++i) {
+                    const Lanes toHouse = ABS_LANES(row - batch.houseRows[i]) + ABS_LANES(col - batch.houseCols[i]);
+                    distance = captured != batch.houseIndices[i] && toHouse < distance ? toHouse : distance;
+                }
 
-        if (my) {
-            score -= SCORE_DISTANCE_TO_HOUSE_MULTIPLIER * dst;
-        } else {
-            score += SCORE_DISTANCE_TO_HOUSE_MULTIPLIER * dst;
+                distance = distance == noHouse ? zero : distance;
+            } else {
+                distance = LOAD_LANES(batch.houseDistances[entityId]);
+            }
+
+            Lanes value = w.baseScore + w.sign * (SCORE_DISTANCE_TO_END_MULTIPLIER * (FIELD_WIDTH - 1 - col)
+                                                  + SCORE_DISTANCE_TO_HOUSE_MULTIPLIER * distance);
+
+            if (w.blockerId >= 0) {
+                const Lanes blockerFree = LOAD_LANES(batch.inHouse[w.blockerId]) == zero,
+                        near = ABS_LANES(row - LOAD_LANES(batch.rows[w.blockerId])) <= one
+                               && ABS_LANES(col - LOAD_LANES(batch.cols[w.blockerId])) <= one;
+
+                value += blockerFree && near ? zero + w.blockedScore : zero;
+            }
+
+            score += LOAD_LANES(batch.inHouse[entityId]) != zero ? zero + w.houseScore : value;
         }
+
+        memcpy(&out[lane], &score, sizeof(Lanes));
     }
 
-    return score;
+#undef ABS_LANES
+#undef LOAD_LANES
+}
 
-    // Undefine macroses at function's end
-#undef isBlockedByEnemyTrainer
-#undef isBlockedByFriendTrainer
+typedef void (*EvaluationKernel)(const ChildBatch &batch, int16_t *out);
+
+void evaluateBatchScalar(const ChildBatch &batch, int16_t *out) {
+    evaluateLanes<int16_t>(batch, out);
 }
 
-pair<int, Move> chooseBestMoveRecursive(const State &state, int depth) {
-    State tmp = state;
-    vector<Move> allMoves = allAvailableMoves(state);
-    vector<pair<int, Move>> movesWithScore;
+#ifdef SIMD_X86
 
-    if (allMoves.empty()) allMoves.push_back(NONE_MOVE);
+__attribute__((target("sse4.1"))) void evaluateBatchSse41(const ChildBatch &batch, int16_t *out) {
+    evaluateLanes<Int16x8>(batch, out);
+}
 
-    for (Move move : allMoves) {
-        tmp.doMove(move);
+__attribute__((target("avx2"))) void evaluateBatchAvx2(const ChildBatch &batch, int16_t *out) {
+    evaluateLanes<Int16x16>(batch, out);
+}
 
-        int score;
-        score = stateScore(tmp);
+const EvaluationKernel EVALUATION_KERNELS[SIMD_LEVELS_COUNT] = {evaluateBatchScalar, evaluateBatchSse41,
+                                                                evaluateBatchAvx2};
+#else
+const EvaluationKernel EVALUATION_KERNELS[SIMD_LEVELS_COUNT] = {evaluateBatchScalar, evaluateBatchScalar,
+                                                                evaluateBatchScalar};
+#endif
 
-        movesWithScore.emplace_back(score, move);
+// Sets @param count lanes, a multiple of ChildBatch::VECTOR_LANES, 8 at a time.
+// The baseline of every target we build for has 16-byte vectors, so this needs no dispatch
+inline void fillLanes(int16_t *lanes, const int count, const int16_t value) {
+    const Int16x8 vector = Int16x8{} + value;
 
-        tmp = state;
-    }
+    for (int lane = 0; lane < count; lane += 8) memcpy(&lanes[lane], &vector, sizeof vector);
+}
 
-    sort(movesWithScore.begin(), movesWithScore.end(),
-         [](const pair<int, Move> &left, const pair<int, Move> &right) { return left.first < right.first; });
+/**
+ * Lays out children of @param state reached by @param moves into @param batch.
+ * Moves must be legal: they come from the move generators.
+ */
+void fillChildBatch(const State &state, const MoveList &moves, ChildBatch &batch) {
+    const Field &field = state.field;
 
-    if (state.currentPlayer == state.myPlayer) {
-        int minScore = movesWithScore.back().first - 50;
-        while (movesWithScore.front().first < minScore) {
-            movesWithScore.erase(movesWithScore.begin());
-        }
-    } else {
-        int maxScore = movesWithScore.back().first + 50;
-        while (movesWithScore.back().first > maxScore) {
-            movesWithScore.pop_back();
-        }
+    batch.count = moves.count;
+    batch.myPlayer = state.myPlayer;
+    batch.anyCapture = false;
+
+    const int lanes = batch.paddedCount();
+
+    for (int entityId = 0; entityId < ENTITIES_COUNT; ++entityId) {
+        if (Entity::typeById(entityId) == Entity::NONE_TYPE) continue;
+
+        const Cell cell = field.positions[entityId];
+        fillLanes(batch.rows[entityId], lanes, (int16_t) cell.row);
+        fillLanes(batch.cols[entityId], lanes, (int16_t) cell.col);
+        fillLanes(batch.inHouse[entityId], lanes, (int16_t) (field.hasHouse(cell) ? -1 : 0));
+        fillLanes(batch.houseDistances[entityId], lanes, (int16_t) field.distanceToNearestHouse(cell));
+    }
+    fillLanes(batch.capturedHouse, lanes, (int16_t) -1);
+
+    batch.housesCount = 0;
+    Bitboard freeHouses = field.freeHouses;
+    while (freeHouses) {
+        const int index = popLowestBit(freeHouses);
+        batch.houseRows[batch.housesCount] = (int16_t) (index / FIELD_WIDTH);
+        batch.houseCols[batch.housesCount] = (int16_t) (index % FIELD_WIDTH);
+        batch.houseIndices[batch.housesCount++] = (int16_t) index;
     }
 
-    if (depth > 0) {
-        for (auto &move : movesWithScore) {
-            tmp.doMove(move.second);
+    for (int lane = 0; lane < moves.count; ++lane) {
+        const Move move = moves.moves[lane];
 
-            move.first = chooseBestMoveRecursive(tmp, depth - 1).first;
+        // Places entity (if any) on cell in this lane and notes a captured house
+        const auto place = [&](const int entityId, const Cell cell) {
+            if (testBit(field.freeHouses, cell.index())) {
+                batch.capturedHouse[lane] = (int16_t) cell.index();
+                batch.anyCapture = true;
+            }
+            if (entityId < 0) return;
+
+            batch.rows[entityId][lane] = (int16_t) cell.row;
+            batch.cols[entityId][lane] = (int16_t) cell.col;
+            batch.inHouse[entityId][lane] = (int16_t) (field.hasHouse(cell) ? -1 : 0);
+            batch.houseDistances[entityId][lane] = (int16_t) field.distanceToNearestHouse(cell);
+        };
+
+        switch (field.checkMove(move)) {
+            case Field::BASE_MOVE:
+            case Field::DOUBLE_MOVE:
+                place(field.cellEntities[move.from.index()], move.to);
+                break;
+
+            case Field::SWAP:
+                place(field.cellEntities[move.from.index()], move.to);
+                place(field.cellEntities[move.to.index()], move.from);
+                break;
 
-            tmp = state;
+            case Field::PUSH:
+                // The pushed entity goes first: the strongman takes its place
+                place(field.cellEntities[move.to.index()],
+                      Cell{2 * move.to.row - move.from.row, 2 * move.to.col - move.from.col});
+                place(field.cellEntities[move.from.index()], move.to);
+                break;
+
+            case Field::ILLEGAL_MOVE:
+            case Field::NO_MOVE:
+                break;
         }
     }
+}
+
+/**
+ * Stores stateScore of each child of @param state reached by @param moves into @param scores,
+ * as it is after the move, but without doing it.
+ */
+void evaluateChildren(const State &state, const MoveList &moves, int *scores) {
+    ChildBatch batch;
+    fillChildBatch(state, moves, batch);
+
+    alignas(32) int16_t out[ChildBatch::LANES];
+    EVALUATION_KERNELS[SIMD_LEVEL](batch, out);
+
+    for (int i = 0; i < moves.count; ++i) {
+        scores[i] = out[i];
+#ifdef DEBUG_EVAL
+        State child = state;
+        child.doMove(moves.moves[i]);
+        assert(scores[i] == fullStateScore(child));
+#endif
+    }
+}
+
+/******************************************** search ******************************************************************/
 
-    sort(movesWithScore.begin(), movesWithScore.end(),
-         [](const pair<int, Move> &left, const pair<int, Move> &right) { return left.first < right.first; });
+static constexpr int SCORE_INFINITY = 32000;
+static constexpr int MAX_PLY = 64;
+static_assert(MAX_PLY <= ZobristKeys::STEPS_HORIZON, "Table entries must not be shared by searches seeing the end");
 
-    if (state.currentPlayer == state.myPlayer) return movesWithScore.back();
-    else return movesWithScore.front();
+// Half-width of the first aspiration window around the score of the previous iteration.
+// Scores rarely move by more unless a house is won or lost, which costs a re-search anyway
+static constexpr int ASPIRATION_WINDOW = 50;
+// Shallow iterations are cheap and their scores are jumpy, so they are searched with the full window
+static constexpr int ASPIRATION_MIN_DEPTH = 4;
+// Trainer blocks are looked at only on the first plies of quiescence, as trainers can shuffle back and forth forever
+static constexpr int QUIESCENCE_BLOCK_PLIES = 2;
+
+bool isGameOver(const State &state) {
+    return state.doneSteps >= MAX_STEPS || !state.field.hasFreeHouses();
 }
 
-Move doMove(const State &state) {
+// stateScore from the point of view of the player to move, as negamax needs it
+int evaluate(const State &state) {
+    const int score = stateScore(state);
+    return state.currentPlayer == state.myPlayer ? score : -score;
+}
 
-    int movesCount = allAvailableMoves(state).size();
-    int depth = floor(log(150.0) / log(movesCount * 1.0));
+struct SearchLimits {
+    steady_clock::time_point deadline;
+    int maxDepth = MAX_PLY;
+    // Set from another thread to abort the search, even before depth 1 is completed
+    const atomic<bool> *stop = nullptr;
+};
 
+// Moves are packed into 7 bits per cell index; from == to is never legal, so 0 stands for NONE_MOVE
+inline uint16_t packMove(const Move move) {
+    if (move == NONE_MOVE) return 0;
+    return (uint16_t) (move.from.index() | move.to.index() << 7);
+}
 
-    Entity acrobat = Entity(state.myPlayer, Entity::ACROBAT);
-    Entity magician = Entity(state.myPlayer, Entity::MAGICIAN);
-    Entity clown1 = Entity(state.myPlayer, Entity::CLOWN, false);
-    Entity clown2 = Entity(state.myPlayer, Entity::CLOWN, true);
+inline Move unpackMove(const uint16_t packed) {
+    if (packed == 0) return NONE_MOVE;
+    return Move{Cell::byIndex(packed & 0x7F), Cell::byIndex(packed >> 7)};
+}
 
-    if (distanceToNearestHouse(state, acrobat) <= 2 && distanceToNearestHouse(state, magician) > 2) {
-        const Move move = Move{
-                state.field.positions.at(magician.id),
-                state.field.positions.at(acrobat.id)};
+/**
+ * Fixed-size hash table of search results, shared by all search threads without locks.
+ * Entries are grouped into buckets of one cache line, so a probe touches a single line of memory.
+ * Each slot keeps the key XORed with the data, so a slot torn by concurrent writes doesn't match any key.
+ */
+struct TranspositionTable {
+    enum Bound : uint8_t {
+        NONE_BOUND = 0,
+        UPPER_BOUND = 1,
+        LOWER_BOUND = 2,
+        EXACT_BOUND = 3,
+    };
 
-        if (state.field.checkMove(move)) return move;
-    }
+    struct Entry {
+        uint64_t key;
+        uint16_t move;
+        int16_t score;
+        int8_t depth;
+        // Bound in 2 low bits, generation of the search in the rest
+        uint8_t boundAndGeneration;
 
-    if (distanceToNearestHouse(state, magician) <= 2) {
-        if (distanceToNearestHouse(state, clown1) > 2) {
-            const Move move = Move{
-                    state.field.positions.at(magician.id),
-                    state.field.positions.at(clown1.id)};
+        Bound bound() const { return (Bound) (boundAndGeneration & 0b11); }
 
-            if (state.field.checkMove(move)) return move;
-        }
-        if (distanceToNearestHouse(state, clown2) > 2) {
-            const Move move = Move{
-                    state.field.positions.at(magician.id),
-                    state.field.positions.at(clown2.id)};
+        int generation() const { return boundAndGeneration >> 2; }
+    };
 
-            if (state.field.checkMove(move)) return move;
-        }
+    // Entry as stored: data is move, score, depth and boundAndGeneration packed into 48 bits
+    struct Slot {
+        atomic<uint64_t> check{0};
+        atomic<uint64_t> data{0};
+    };
+
+    struct alignas(64) Bucket {
+        Slot slots[4];
+    };
+
+    explicit TranspositionTable(const size_t megabytes) {
+        resize(megabytes);
     }
 
-    auto moveInfo = chooseBestMoveRecursive(state, depth);
+    // Bucket count is rounded down to a power of two
+    void resize(const size_t megabytes) {
+        size_t count = 1;
+        while (count * 2 * sizeof(Bucket) <= megabytes << 20) count *= 2;
 
+        // operator new doesn't respect alignment of Bucket before C++17
+        memory.reset(new char[count * sizeof(Bucket) + alignof(Bucket)]);
+        const auto address = (uintptr_t) memory.get();
+        buckets = new((void *) ((address + alignof(Bucket) - 1) & ~(uintptr_t) (alignof(Bucket) - 1))) Bucket[count];
+        bucketMask = count - 1;
 
-    return moveInfo.second;
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i <= bucketMask; ++i) {
+            for (Slot &slot : buckets[i].slots) {
+                slot.check.store(0, memory_order_relaxed);
+                slot.data.store(0, memory_order_relaxed);
+            }
+        }
+        generation = 0;
+    }
+
+    // Entries of previous searches are replaced first
+    void newSearch() {
+        generation = (generation + 1) & GENERATION_MASK;
+    }
+
+    bool probe(const uint64_t key, Entry &out) const {
+        for (const Slot &slot : buckets[key & bucketMask].slots) {
+            const Entry entry = load(slot);
+            if (entry.key == key && entry.bound() != NONE_BOUND) {
+                out = entry;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(const uint64_t key, const int depth, const int score, const Bound bound, const Move move) {
+        Bucket &bucket = buckets[key & bucketMask];
+
+        // Same position if it is in the bucket, otherwise the least valuable entry
+        Slot *target = &bucket.slots[0];
+        Entry targetEntry = load(*target);
+        for (Slot &slot : bucket.slots) {
+            const Entry entry = load(slot);
+            if (entry.key == key && entry.bound() != NONE_BOUND) {
+                target = &slot;
+                targetEntry = entry;
+                break;
+            }
+            if (replacementValue(entry) < replacementValue(targetEntry)) {
+                target = &slot;
+                targetEntry = entry;
+            }
+        }
+
+        uint16_t packedMove = packMove(move);
+        // Fail-low results have no best move, keep the one we knew before
+        if (packedMove == 0 && targetEntry.key == key) packedMove = targetEntry.move;
+
+        const uint64_t data = (uint64_t) packedMove
+                              | (uint64_t) (uint16_t) score << 16
+                              | (uint64_t) (uint8_t) depth << 32
+                              | (uint64_t) (bound | generation << 2) << 40;
+        target->check.store(key ^ data, memory_order_relaxed);
+        target->data.store(data, memory_order_relaxed);
+    }
+
+private:
+    static constexpr int GENERATION_MASK = 0b111111;
+
+    unique_ptr<char[]> memory;
+    Bucket *buckets = nullptr;
+    size_t bucketMask = 0;
+    // Changed only between searches
+    int generation = 0;
+
+    static Entry load(const Slot &slot) {
+        const uint64_t data = slot.data.load(memory_order_relaxed);
+        return Entry{slot.check.load(memory_order_relaxed) ^ data,
+                     (uint16_t) data, (int16_t) (data >> 16), (int8_t) (data >> 32), (uint8_t) (data >> 40)};
+    }
+
+    // Deep entries are worth keeping, but an entry loses its value as it gets older
+    int replacementValue(const Entry &entry) const {
+        if (entry.bound() == NONE_BOUND) return -SCORE_INFINITY;
+
+        const int age = (generation - entry.generation()) & GENERATION_MASK;
+        return entry.depth - 4 * age;
+    }
+};
+
+struct SearchStats {
+    uint64_t nodes = 0;
+    uint64_t tableHits = 0;
+    // Last completed depth and its score
+    int depth = 0;
+    int score = 0;
+    // Monte Carlo playouts; tree search reports its deepest path as depth
+    uint64_t playouts = 0;
+    uint64_t playoutsPerSecond = 0;
+
+    // Move ordering quality: beta cutoffs by the number of the move which caused them...
+    uint64_t cutoffs = 0;
+    uint64_t firstMoveCutoffs = 0;
+    uint64_t secondMoveCutoffs = 0;
+    // ... and by the source of the move
+    uint64_t hashMoveCutoffs = 0;
+    uint64_t killerCutoffs = 0;
+    // Quiet moves which were ordered by a non-zero history score
+    uint64_t historyCutoffs = 0;
+
+    // Root searches repeated after the score fell out of the aspiration window
+    uint64_t aspirationResearches = 0;
+    // Zero-window searches which failed high inside the window and were repeated with it
+    uint64_t pvsResearches = 0;
+    // Nodes searched by quiescence, included in nodes
+    uint64_t quiescenceNodes = 0;
+};
+
+// Base and double moves outside of houses
+bool isQuietMove(const Field &field, const Move move) {
+    const Field::MoveType type = field.checkMove(move);
+    return (type == Field::BASE_MOVE || type == Field::DOUBLE_MOVE) && !field.hasHouse(move.to);
+}
+
+/**
+ * How often quiet moves caused beta cutoffs, indexed by (entity type, from cell, to cell).
+ * Kept across searches of a game, but older results weigh less.
+ */
+struct HistoryTable {
+    static constexpr int MAX_SCORE = 1 << 24;
+
+    int scores[Entity::TYPES_COUNT][FIELD_CELLS][FIELD_CELLS] = {};
+
+    int score(const Field &field, const Move move) const {
+        return scores[field.entityAt(move.from).type][move.from.index()][move.to.index()];
+    }
+
+    void reward(const Field &field, const Move move, const int depth) {
+        int &value = scores[field.entityAt(move.from).type][move.from.index()][move.to.index()];
+        value = min(value + depth * depth, (int) MAX_SCORE);
+    }
+
+    void age() {
+        for (auto &type : scores) {
+            for (auto &from : type) {
+                for (int &value : from) value /= 2;
+            }
+        }
+    }
+};
+
+/**
+ * Sorts moves by @param scores, given for each move, highest first.
+ * Insertion sort: lists are short and this keeps equal moves in generation order
+ */
+void sortByScores(MoveList &list, int *scores) {
+    for (int i = 1; i < list.count; ++i) {
+        const Move move = list.moves[i];
+        const int score = scores[i];
+
+        int j = i;
+        for (; j > 0 && scores[j - 1] < score; --j) {
+            list.moves[j] = list.moves[j - 1];
+            scores[j] = scores[j - 1];
+        }
+        list.moves[j] = move;
+        scores[j] = score;
+    }
+}
+
+/**
+ * Sorts moves by static evaluation of the child, best first.
+ * @param scores buffer for evaluations, at least as long as the list
+ */
+void sortByEvaluation(const State &state, MoveList &list, int *scores) {
+    evaluateChildren(state, list, scores);
+
+    // Children are scored for myPlayer, but sorted for the player to move
+    if (state.currentPlayer != state.myPlayer) {
+        for (int i = 0; i < list.count; ++i) scores[i] = -scores[i];
+    }
+
+    sortByScores(list, scores);
+}
+
+/**
+ * Hands out moves of a node one at a time: the hash move, captures, pushes and swaps, killers and then quiet moves.
+ * A stage is generated only when the previous ones are exhausted, so after a cutoff the rest is never generated.
+ */
+struct MovePicker {
+    enum Stage {
+        HASH_MOVE,
+        CAPTURES,
+        PUSHES_AND_SWAPS,
+        KILLERS,
+        QUIETS,
+        PASS,
+        DONE,
+    };
+
+    /**
+     * @param list buffer for moves of the current stage
+     * @param scores buffer for move scores
+     * @param hashMove best move from the transposition table, NONE_MOVE if there is no one
+     * @param killers two quiet moves which caused cutoffs on the same ply
+     * @param sortStages whether to sort captures, pushes and swaps by static evaluation;
+     * worth it unless children are leaves
+     */
+    MovePicker(State &state, MoveList &list, int *scores, const Move hashMove, const Move *killers,
+               const HistoryTable &history, const bool sortStages) :
+            state(state), list(list), scores(scores), hashMove(hashMove), killers(killers), history(history),
+            sortStages(sortStages) {
+        list.count = 0;
+        // Hash move may be illegal after a key collision
+        if (isOwnLegalMove(hashMove)) list.push_back(hashMove);
+        else this->hashMove = NONE_MOVE;
+    }
+
+    // Stage of the last picked move
+    Stage currentStage() const {
+        return stage;
+    }
+
+    // History score of the last picked quiet move
+    int currentHistoryScore() const {
+        return stage == QUIETS ? scores[index - 1] : 0;
+    }
+
+    bool next(Move &move) {
+        while (true) {
+            while (index == list.count) {
+                if (stage == DONE) return false;
+
+                stage = (Stage) (stage + 1);
+                list.count = 0;
+                index = 0;
+
+                fillStage();
+            }
+
+            move = list.moves[index++];
+
+            // Hash move and killers were already picked before their stages
+            if (stage > HASH_MOVE && move == hashMove) continue;
+            if (stage == QUIETS && (move == pickedKillers[0] || move == pickedKillers[1])) continue;
+
+            pickedCount++;
+            return true;
+        }
+    }
+
+private:
+    State &state;
+    MoveList &list;
+    int *scores;
+    Move hashMove;
+    const Move *killers;
+    const HistoryTable &history;
+    const bool sortStages;
+
+    Stage stage = HASH_MOVE;
+    int index = 0;
+    int pickedCount = 0;
+    Move pickedKillers[2] = {NONE_MOVE, NONE_MOVE};
+
+    void fillStage() {
+        switch (stage) {
+            case CAPTURES:
+                generateMoves(state, CAPTURE_MOVES, list);
+                if (sortStages) sortByEvaluation(state, list, scores);
+                break;
+
+            case PUSHES_AND_SWAPS:
+                generateMoves(state, PUSH_AND_SWAP_MOVES, list);
+                if (sortStages) sortByEvaluation(state, list, scores);
+                break;
+
+            case KILLERS:
+                // Killers come from other positions, so they have to be checked
+                for (int i = 0; i < 2; ++i) {
+                    const Move killer = killers[i];
+                    if (killer == hashMove || !isOwnLegalMove(killer) || !isQuietMove(state.field, killer)) continue;
+
+                    list.push_back(killer);
+                    pickedKillers[i] = killer;
+                }
+                break;
+
+            case QUIETS:
+                generateMoves(state, QUIET_MOVES, list);
+                sortByHistory();
+                break;
+
+            case PASS:
+                // Passing is allowed only when there is nothing else to do
+                if (pickedCount == 0) list.push_back(NONE_MOVE);
+                break;
+
+            case HASH_MOVE:
+            case DONE:
+                break;
+        }
+    }
+
+    void sortByHistory() {
+        for (int i = 0; i < list.count; ++i) {
+            scores[i] = history.score(state.field, list.moves[i]);
+        }
+
+        // Moves without history stay in generation order
+        sortByScores(list, scores);
+    }
+
+    bool isOwnLegalMove(const Move move) const {
+        if (move == NONE_MOVE) return false;
+
+        const Field::MoveType type = state.field.checkMove(move);
+        return type != Field::ILLEGAL_MOVE && type != Field::NO_MOVE
+               && state.field.entityAt(move.from).ownerId == state.currentPlayer;
+    }
+};
+
+/**
+ * Iterative deepening alpha-beta (negamax) search over a single mutable state.
+ * Per-ply buffers live here, so search nodes neither allocate nor construct move lists.
+ */
+struct Searcher {
+    // Deadline is checked once per this many nodes
+    static constexpr uint64_t TIME_CHECK_PERIOD = 1024;
+
+    MoveList moves[MAX_PLY];
+    int moveScores[MAX_PLY][MoveList::CAPACITY];
+
+    TranspositionTable &table;
+
+    // Move ordering tables, kept across searches of a game
+    Move killers[MAX_PLY][2];
+    HistoryTable history;
+
+    SearchLimits limits;
+    SearchStats stats;
+    bool aborted = false;
+
+    // Helper threads of Lazy SMP (index > 0) vary the search a bit, so that they don't just repeat the main thread
+    const int threadIndex;
+
+    /**
+     * Deeper table entries may cut off shallower searches. Deterministic searches turn that off,
+     * as which deeper entries are there depends on timing of threads.
+     */
+    bool trustDeeperEntries = true;
+
+    explicit Searcher(TranspositionTable &table, const int threadIndex = 0) : table(table), threadIndex(threadIndex) {}
+
+    virtual ~Searcher() = default;
+
+    /**
+     * Deepens the search from @param state, where myPlayer is to move, until the deadline or max depth.
+     * @return score (as stateScore) and the best move of the last completed depth
+     */
+    pair<int, Move> search(State &state, const SearchLimits &searchLimits) {
+        const steady_clock::time_point start = steady_clock::now();
+
+        prepare(searchLimits);
+
+        MoveList &rootMoves = moves[0];
+        allAvailableMoves(state, rootMoves);
+        if (rootMoves.empty()) rootMoves.push_back(NONE_MOVE);
+        sortByEvaluation(state, rootMoves, moveScores[0]);
+
+        pair<int, Move> best{evaluate(state), rootMoves.moves[0]};
+
+        // Nothing to think about
+        if (rootMoves.size() == 1) return best;
+
+        // Every other helper starts one depth deeper, and each helper tries its own root move first
+        if (threadIndex > 0) swap(rootMoves.moves[0], rootMoves.moves[threadIndex % rootMoves.count]);
+        const int firstDepth = 1 + threadIndex % 2;
+
+        for (int depth = firstDepth; depth <= limits.maxDepth && depth < MAX_PLY; ++depth) {
+            const pair<int, Move> result = searchAspirated(state, rootMoves, depth, best.first);
+            if (aborted) break;
+
+            best = result;
+            stats.depth = depth;
+            stats.score = result.first;
+
+            // The best move is searched first on the next iteration
+            Move *const bestPosition = find(rootMoves.moves, rootMoves.moves + rootMoves.count, best.second);
+            rotate(rootMoves.moves, bestPosition, bestPosition + 1);
+
+            // The next iteration takes longer than all previous ones together, so it won't finish anyway
+            const steady_clock::time_point now = steady_clock::now();
+            if (now + (now - start) >= limits.deadline) break;
+        }
+
+        return best;
+    }
+
+    // Resets the search state and ages move ordering tables before a new search
+    void prepare(const SearchLimits &searchLimits) {
+        limits = searchLimits;
+        stats = SearchStats();
+        aborted = false;
+
+        // Plies are shifted by two moves since the previous search, killers of ply p + 2 are the best guess for ply p
+        for (int ply = 0; ply < MAX_PLY; ++ply) {
+            killers[ply][0] = ply + 2 < MAX_PLY ? killers[ply + 2][0] : NONE_MOVE;
+            killers[ply][1] = ply + 2 < MAX_PLY ? killers[ply + 2][1] : NONE_MOVE;
+        }
+        history.age();
+    }
+
+protected:
+    // Searches the root with a narrow window around @param previousScore, widening it while the score falls out
+    pair<int, Move> searchAspirated(State &state, const MoveList &rootMoves, const int depth, const int previousScore) {
+        if (depth < ASPIRATION_MIN_DEPTH) return searchRoot(state, rootMoves, depth, -SCORE_INFINITY, SCORE_INFINITY);
+
+        int delta = ASPIRATION_WINDOW;
+        int alpha = max(previousScore - delta, -SCORE_INFINITY),
+                beta = min(previousScore + delta, SCORE_INFINITY);
+
+        while (true) {
+            const pair<int, Move> result = searchRoot(state, rootMoves, depth, alpha, beta);
+            if (aborted) return result;
+
+            if (result.first <= alpha && alpha > -SCORE_INFINITY) {
+                alpha = max(result.first - delta, -SCORE_INFINITY);
+            } else if (result.first >= beta && beta < SCORE_INFINITY) {
+                beta = min(result.first + delta, SCORE_INFINITY);
+            } else {
+                return result;
+            }
+
+            stats.aspirationResearches++;
+            delta *= 4;
+        }
+    }
+
+    // Principal variation search of the root in window (alpha, beta), fail-soft
+    virtual pair<int, Move> searchRoot(State &state, const MoveList &rootMoves, const int depth, int alpha,
+                                       const int beta) {
+        const int originalAlpha = alpha;
+        int bestScore = -SCORE_INFINITY;
+        Move bestMove = rootMoves.moves[0];
+
+        for (int i = 0; i < rootMoves.count; ++i) {
+            const Move move = rootMoves.moves[i];
+
+            const Field::Undo undo = state.doMove(move);
+            const int score = searchChild(state, depth - 1, alpha, beta, 1, i == 0);
+            state.undoMove(undo);
+
+            if (aborted) break;
+
+            if (score > bestScore) {
+                bestScore = score;
+                bestMove = move;
+                if (score > alpha) alpha = score;
+                if (alpha >= beta) break;
+            }
+        }
+
+        if (!aborted) {
+            if (bestScore <= originalAlpha) {
+                table.store(state.key(), depth, bestScore, TranspositionTable::UPPER_BOUND, NONE_MOVE);
+            } else {
+                table.store(state.key(), depth, bestScore,
+                            bestScore >= beta ? TranspositionTable::LOWER_BOUND : TranspositionTable::EXACT_BOUND,
+                            bestMove);
+            }
+        }
+
+        return make_pair(bestScore, bestMove);
+    }
+
+    /**
+     * Score of the child the last move led to, from the point of view of the parent.
+     * Only the first move of a node is searched with the full window: the rest are expected to fail low,
+     * which a zero window proves cheaper. Moves which don't are searched again with the full window.
+     */
+    int searchChild(State &state, const int depth, const int alpha, const int beta, const int ply,
+                    const bool firstMove) {
+        if (firstMove) return -negamax(state, depth, -beta, -alpha, ply);
+
+        const int score = -negamax(state, depth, -alpha - 1, -alpha, ply);
+        if (score <= alpha || score >= beta || aborted) return score;
+
+        stats.pvsResearches++;
+        return -negamax(state, depth, -beta, -alpha, ply);
+    }
+
+    void onCutoff(const State &state, const MovePicker &picker, const Move move, const int moveNumber,
+                  const int depth, const int ply) {
+        stats.cutoffs++;
+        if (moveNumber == 1) stats.firstMoveCutoffs++;
+        if (moveNumber == 2) stats.secondMoveCutoffs++;
+
+        switch (picker.currentStage()) {
+            case MovePicker::HASH_MOVE:
+                stats.hashMoveCutoffs++;
+                break;
+            case MovePicker::KILLERS:
+                stats.killerCutoffs++;
+                break;
+            case MovePicker::QUIETS:
+                if (picker.currentHistoryScore() > 0) stats.historyCutoffs++;
+                break;
+            default:
+                break;
+        }
+
+        if (!isQuietMove(state.field, move)) return;
+
+        history.reward(state.field, move, depth);
+
+        if (!(killers[ply][0] == move)) {
+            killers[ply][1] = killers[ply][0];
+            killers[ply][0] = move;
+        }
+    }
+
+    void checkDeadline() {
+        if (stats.nodes % TIME_CHECK_PERIOD == 0) checkStop();
+    }
+
+    // Depth 1 is always completed unless stopped from outside, so there is always a move to return
+    void checkStop() {
+        if ((limits.stop && limits.stop->load(memory_order_relaxed))
+            || (stats.depth > 0 && steady_clock::now() >= limits.deadline))
+            aborted = true;
+    }
+
+    /**
+     * Searches only tactical moves below the horizon, so that it never stops right before a house is taken.
+     * The player to move may stand pat on the static evaluation instead, which keeps this search small.
+     * @param quiescencePly plies searched since the horizon
+     */
+    int quiescence(State &state, int alpha, const int beta, const int ply, const int quiescencePly) {
+        stats.nodes++;
+        stats.quiescenceNodes++;
+        checkDeadline();
+        if (aborted) return 0;
+
+        const int standPat = evaluate(state);
+        if (ply >= MAX_PLY || isGameOver(state) || standPat >= beta) return standPat;
+        if (standPat > alpha) alpha = standPat;
+
+        MoveList &list = moves[ply];
+        list.count = 0;
+        // Not sorted: entering a house rebuilds house distances, which would cost more than the ordering saves
+        generateTacticalMoves(state, quiescencePly < QUIESCENCE_BLOCK_PLIES, list);
+
+        int bestScore = standPat;
+        for (int i = 0; i < list.count; ++i) {
+            const Field::Undo undo = state.doMove(list.moves[i]);
+            const int score = -quiescence(state, -beta, -alpha, ply + 1, quiescencePly + 1);
+            state.undoMove(undo);
+
+            if (aborted) return 0;
+
+            if (score > bestScore) {
+                bestScore = score;
+                if (score > alpha) alpha = score;
+                if (alpha >= beta) break;
+            }
+        }
+
+        return bestScore;
+    }
+
+    int negamax(State &state, const int depth, int alpha, const int beta, const int ply) {
+        if (depth <= 0) return quiescence(state, alpha, beta, ply, 0);
+
+        stats.nodes++;
+        checkDeadline();
+        if (aborted) return 0;
+
+        if (ply >= MAX_PLY || isGameOver(state)) return evaluate(state);
+
+        const uint64_t key = state.key();
+        const int originalAlpha = alpha;
+        Move hashMove = NONE_MOVE;
+
+        TranspositionTable::Entry entry{};
+        if (table.probe(key, entry)) {
+            stats.tableHits++;
+            hashMove = unpackMove(entry.move);
+
+            if (entry.depth == depth || (entry.depth > depth && trustDeeperEntries)) {
+                switch (entry.bound()) {
+                    case TranspositionTable::EXACT_BOUND:
+                        return entry.score;
+                    case TranspositionTable::LOWER_BOUND:
+                        if (entry.score >= beta) return entry.score;
+                        break;
+                    case TranspositionTable::UPPER_BOUND:
+                        if (entry.score <= alpha) return entry.score;
+                        break;
+                    case TranspositionTable::NONE_BOUND:
+                        break;
+                }
+            }
+        }
+
+        MovePicker picker(state, moves[ply], moveScores[ply], hashMove, killers[ply], history, depth > 1);
+
+        int bestScore = -SCORE_INFINITY;
+        Move bestMove = NONE_MOVE;
+        Move move;
+        int moveNumber = 0;
+        while (picker.next(move)) {
+            moveNumber++;
+
+            const Field::Undo undo = state.doMove(move);
+            const int score = searchChild(state, depth - 1, alpha, beta, ply + 1, moveNumber == 1);
+            state.undoMove(undo);
+
+            // Results of an interrupted search are not reliable
+            if (aborted) return 0;
+
+            if (score > bestScore) {
+                bestScore = score;
+                bestMove = move;
+                if (score > alpha) alpha = score;
+                if (alpha >= beta) {
+                    onCutoff(state, picker, move, moveNumber, depth, ply);
+                    break;
+                }
+            }
+        }
+
+        if (bestScore <= originalAlpha) {
+            table.store(key, depth, bestScore, TranspositionTable::UPPER_BOUND, NONE_MOVE);
+        } else {
+            table.store(key, depth, bestScore,
+                        bestScore >= beta ? TranspositionTable::LOWER_BOUND : TranspositionTable::EXACT_BOUND,
+                        bestMove);
+        }
+
+        return bestScore;
+    }
+};
+
+// Move searches and pondering fill the same tables, so that even a ponder miss isn't wasted
+TranspositionTable &sharedTable() {
+    static TranspositionTable table(config.hashMegabytes);
+    return table;
+}
+
+// Binds the calling thread to a single core, so that the scheduler doesn't move it and its caches around
+void pinCurrentThread(const int core) {
+#ifdef __linux__
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core % max(1u, thread::hardware_concurrency()), &cores);
+    pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+#else
+    (void) core;
+#endif
+}
+
+// Whatever searches moves: all engines share this interface, so that doMove and pondering don't depend on the choice
+struct SearchEngine {
+    // Stats of the last search
+    SearchStats stats;
+
+    virtual ~SearchEngine() = default;
+
+    /**
+     * Searches @param state, where myPlayer is to move, within @param limits.
+     * @return score (as stateScore) and the best move
+     */
+    virtual pair<int, Move> search(const State &state, const SearchLimits &limits) = 0;
+};
+
+/**
+ * Lazy SMP: every thread runs the same iterative deepening search of the root and they share nothing
+ * but the transposition table, where each thread finds the work of the others.
+ * The calling thread runs the main searcher; the result of the thread which completed the deepest search is used.
+ */
+struct LazySmpEngine : SearchEngine {
+    TranspositionTable &table;
+    vector<unique_ptr<Searcher>> searchers;
+    const bool pinThreads;
+
+    LazySmpEngine(TranspositionTable &table, const int threads, const bool pinThreads) :
+            table(table), pinThreads(pinThreads) {
+        for (int i = 0; i < threads; ++i) searchers.emplace_back(new Searcher(table, i));
+    }
+
+    pair<int, Move> search(const State &state, const SearchLimits &limits) override {
+        // Before the helpers start, as they read the generation
+        table.newSearch();
+
+        // Helpers stop when the main searcher is done
+        atomic<bool> helpersStop{false};
+        SearchLimits helperLimits = limits;
+        helperLimits.stop = &helpersStop;
+
+        vector<thread> helpers;
+        vector<pair<int, Move>> results(searchers.size());
+
+        for (size_t i = 1; i < searchers.size(); ++i) {
+            helpers.emplace_back([this, &state, &helperLimits, &results, i]() {
+                if (pinThreads) pinCurrentThread((int) i);
+
+                State helperState = state;
+                results[i] = searchers[i]->search(helperState, helperLimits);
+            });
+        }
+
+        if (pinThreads) pinCurrentThread(0);
+
+        State mainState = state;
+        results[0] = searchers[0]->search(mainState, limits);
+
+        helpersStop = true;
+        for (thread &helper : helpers) helper.join();
+
+        size_t best = 0;
+        uint64_t nodes = 0, tableHits = 0;
+        for (size_t i = 0; i < searchers.size(); ++i) {
+            if (searchers[i]->stats.depth > searchers[best]->stats.depth) best = i;
+
+            nodes += searchers[i]->stats.nodes;
+            tableHits += searchers[i]->stats.tableHits;
+        }
+
+        // Stats of the thread whose result is used, but with nodes and table hits of all threads
+        stats = searchers[best]->stats;
+        stats.nodes = nodes;
+        stats.tableHits = tableHits;
+
+        return results[best];
+    }
+};
+
+/**
+ * Node of the tree shared by threads of the Young Brothers Wait search: the rest of its moves are taken one by one
+ * by the thread which reached the node and by any idle threads which joined it.
+ */
+struct SplitPoint {
+    // Split point above this one, whose cutoff aborts this one as well
+    SplitPoint *const parent;
+    // Copied, as the owner thread keeps changing its own state
+    const State state;
+    const int depth, ply, beta;
+    // All moves of the node; the first one was searched before the split
+    MoveList moves;
+
+    mutex lock;
+    // Guarded by lock: window bound, index of the best move or -1 if none beat the original alpha, next move to take
+    int alpha;
+    int bestIndex;
+    int nextIndex = 1;
+    // Threads other than the owner which are searching moves of this node
+    atomic<int> helpers{0};
+    atomic<bool> cutoff{false};
+
+    SplitPoint(SplitPoint *parent, const State &state, const int depth, const int ply, const int alpha,
+               const int beta, const int bestIndex)
+            : parent(parent), state(state), depth(depth), ply(ply), beta(beta), alpha(alpha), bestIndex(bestIndex) {}
+
+    // Whether @param ancestor is above this split point
+    bool descendsFrom(const SplitPoint *ancestor) const {
+        for (const SplitPoint *point = parent; point; point = point->parent) {
+            if (point == ancestor) return true;
+        }
+        return false;
+    }
+};
+
+// Nodes at least this deep are split between threads; shallower ones are cheaper to search than to share
+static constexpr int YBW_MIN_SPLIT_DEPTH = 3;
+
+/**
+ * Thread of the Young Brothers Wait search. Nodes return values clamped to their window (fail-hard), which depend
+ * neither on move order nor on which thread searched which move, so the result is the same on every run.
+ */
+struct YbwWorker : Searcher {
+    // All workers of the search, this one included
+    const vector<YbwWorker *> &team;
+    // Workers looking for split points to join
+    atomic<int> &idleWorkers;
+    // Set when the search is over or the main worker was aborted
+    atomic<bool> &teamStop;
+
+    // Innermost split point this worker is searching a move of
+    SplitPoint *current = nullptr;
+
+    YbwWorker(TranspositionTable &table, const int threadIndex, const vector<YbwWorker *> &team,
+              atomic<int> &idleWorkers, atomic<bool> &teamStop)
+            : Searcher(table, threadIndex), team(team), idleWorkers(idleWorkers), teamStop(teamStop) {
+        trustDeeperEntries = false;
+    }
+
+    // Joins split points of other workers until @param searchDone is set
+    void help(const atomic<bool> &searchDone) {
+        idleWorkers++;
+        while (!searchDone.load()) {
+            SplitPoint *const point = join(nullptr);
+            if (!point) {
+                this_thread::yield();
+                continue;
+            }
+
+            idleWorkers--;
+            searchSplitMoves(*point);
+            point->helpers--;
+            idleWorkers++;
+        }
+        idleWorkers--;
+    }
+
+protected:
+    pair<int, Move> searchRoot(State &state, const MoveList &rootMoves, const int depth, int alpha,
+                               const int beta) override {
+        const int originalAlpha = alpha;
+
+        const Field::Undo undo = state.doMove(rootMoves.moves[0]);
+        const int score = searchChild(state, depth - 1, alpha, beta, 1, true);
+        state.undoMove(undo);
+
+        if (isAborted()) return make_pair(alpha, rootMoves.moves[0]);
+
+        if (score > alpha) alpha = score;
+
+        int bestIndex = alpha > originalAlpha ? 0 : -1;
+        if (alpha < beta) {
+            SplitPoint point(current, state, depth, 0, alpha, beta, bestIndex);
+            point.moves = rootMoves;
+
+            alpha = searchSplit(point);
+            bestIndex = point.bestIndex;
+
+            if (isAborted()) return make_pair(alpha, rootMoves.moves[0]);
+        }
+
+        const Move bestMove = bestIndex >= 0 ? rootMoves.moves[bestIndex] : rootMoves.moves[0];
+        store(state.key(), depth, originalAlpha, alpha, beta, bestMove);
+
+        return make_pair(alpha, bestMove);
+    }
+
+private:
+    // Whether the current node is to be abandoned: the search is stopped or a split point above it has a cutoff
+    bool isAborted() {
+        if (aborted) {
+            // Helpers of the main worker would wait for nothing
+            teamStop = true;
+            return true;
+        }
+
+        for (const SplitPoint *point = current; point; point = point->parent) {
+            if (point->cutoff.load(memory_order_relaxed)) return true;
+        }
+        return false;
+    }
+
+    // Same as in the serial search, but values are clamped to the window
+    int searchChild(State &state, const int depth, const int alpha, const int beta, const int ply,
+                    const bool firstMove) {
+        if (!firstMove) {
+            const int score = -searchNode(state, depth, -alpha - 1, -alpha, ply);
+            if (score <= alpha || score >= beta || isAborted()) return score;
+
+            stats.pvsResearches++;
+        }
+
+        return -searchNode(state, depth, -beta, -alpha, ply);
+    }
+
+    int searchNode(State &state, const int depth, int alpha, const int beta, const int ply) {
+        // Clamping a fail-soft result gives exactly the fail-hard one
+        if (depth < YBW_MIN_SPLIT_DEPTH) return max(alpha, min(beta, negamax(state, depth, alpha, beta, ply)));
+
+        stats.nodes++;
+        checkDeadline();
+        if (isAborted()) return 0;
+
+        if (ply >= MAX_PLY || isGameOver(state)) return max(alpha, min(beta, evaluate(state)));
+
+        const uint64_t key = state.key();
+        const int originalAlpha = alpha;
+        Move hashMove = NONE_MOVE;
+
+        // Only entries of the same depth are exact for this node, see trustDeeperEntries
+        TranspositionTable::Entry entry{};
+        if (table.probe(key, entry)) {
+            stats.tableHits++;
+            hashMove = unpackMove(entry.move);
+
+            if (entry.depth == depth) {
+                switch (entry.bound()) {
+                    case TranspositionTable::EXACT_BOUND:
+                        return max(alpha, min(beta, (int) entry.score));
+                    case TranspositionTable::LOWER_BOUND:
+                        if (entry.score >= beta) return beta;
+                        break;
+                    case TranspositionTable::UPPER_BOUND:
+                        if (entry.score <= alpha) return alpha;
+                        break;
+                    case TranspositionTable::NONE_BOUND:
+                        break;
+                }
+            }
+        }
+
+        MovePicker picker(state, moves[ply], moveScores[ply], hashMove, killers[ply], history, true);
+
+        Move bestMove = NONE_MOVE;
+        Move move;
+        int moveNumber = 0;
+        while (picker.next(move)) {
+            moveNumber++;
+
+            const Field::Undo undo = state.doMove(move);
+            const int score = searchChild(state, depth - 1, alpha, beta, ply + 1, moveNumber == 1);
+            state.undoMove(undo);
+
+            if (isAborted()) return 0;
+
+            if (score > alpha) {
+                alpha = score;
+                bestMove = move;
+
+                if (alpha >= beta) {
+                    onCutoff(state, picker, move, moveNumber, depth, ply);
+                    break;
+                }
+            }
+
+            // The eldest brother is searched, the young ones may be searched in parallel
+            if (moveNumber == 1 && idleWorkers.load(memory_order_relaxed) > 0) {
+                SplitPoint point(current, state, depth, ply, alpha, beta, alpha > originalAlpha ? 0 : -1);
+                point.moves.push_back(move);
+                while (picker.next(move)) point.moves.push_back(move);
+
+                alpha = searchSplit(point);
+                if (isAborted()) return 0;
+
+                if (point.bestIndex >= 0) bestMove = point.moves.moves[point.bestIndex];
+                break;
+            }
+        }
+
+        store(key, depth, originalAlpha, alpha, beta, bestMove);
+
+        return alpha;
+    }
+
+    /**
+     * Searches the young brothers of @param point along with whoever joins it, and waits for the helpers.
+     * @return value of the node, clamped to its window
+     */
+    int searchSplit(SplitPoint &point) {
+        {
+            lock_guard<mutex> guard(splitsLock);
+            splits.push_back(&point);
+        }
+
+        searchSplitMoves(point);
+
+        // Nobody joins the point after this, so waiting for the helpers is enough
+        {
+            lock_guard<mutex> guard(splitsLock);
+            splits.pop_back();
+        }
+
+        while (point.helpers.load() > 0) {
+            // Helps the helpers meanwhile: their split points are below this one
+            SplitPoint *const below = join(&point);
+            if (below) {
+                searchSplitMoves(*below);
+                below->helpers--;
+            } else {
+                checkStop();
+                isAborted();
+                this_thread::yield();
+            }
+        }
+
+        return point.cutoff ? point.beta : point.alpha;
+    }
+
+    // Takes moves of @param point one by one until none are left or the point is cut off
+    void searchSplitMoves(SplitPoint &point) {
+        SplitPoint *const previous = current;
+        current = &point;
+
+        State state = point.state;
+        while (true) {
+            int index, alpha;
+            {
+                lock_guard<mutex> guard(point.lock);
+                if (point.cutoff || point.nextIndex >= point.moves.count) break;
+
+                index = point.nextIndex++;
+                // Moves before the best one have to show they are as good as it to take its place, as in serial search
+                alpha = point.bestIndex >= 0 && index < point.bestIndex ? point.alpha - 1 : point.alpha;
+            }
+
+            const Move move = point.moves.moves[index];
+            const Field::Undo undo = state.doMove(move);
+            const int score = searchChild(state, point.depth - 1, alpha, point.beta, point.ply + 1, false);
+            state.undoMove(undo);
+
+            if (isAborted()) break;
+
+            lock_guard<mutex> guard(point.lock);
+            if (score <= alpha) continue;
+
+            if (score > point.alpha || (score == point.alpha && index < point.bestIndex)) {
+                point.alpha = score;
+                point.bestIndex = index;
+            }
+            if (point.alpha >= point.beta) point.cutoff = true;
+        }
+
+        current = previous;
+    }
+
+    /**
+     * Joins a split point with moves left: any one if @param ancestor is null, otherwise one below @param ancestor.
+     * @return the joined split point or null
+     */
+    SplitPoint *join(const SplitPoint *ancestor) {
+        for (YbwWorker *worker : team) {
+            lock_guard<mutex> guard(worker->splitsLock);
+
+            // Outermost split points first, they have the most work left
+            for (SplitPoint *point : worker->splits) {
+                if (ancestor && !point->descendsFrom(ancestor)) continue;
+
+                lock_guard<mutex> pointGuard(point->lock);
+                if (point->cutoff || point->nextIndex >= point->moves.count) continue;
+
+                point->helpers++;
+                return point;
+            }
+        }
+        return nullptr;
+    }
+
+    void store(const uint64_t key, const int depth, const int originalAlpha, const int alpha, const int beta,
+               const Move bestMove) {
+        if (alpha <= originalAlpha) {
+            table.store(key, depth, alpha, TranspositionTable::UPPER_BOUND, NONE_MOVE);
+        } else {
+            table.store(key, depth, alpha,
+                        alpha >= beta ? TranspositionTable::LOWER_BOUND : TranspositionTable::EXACT_BOUND, bestMove);
+        }
+    }
+
+    // Split points of this worker which others may join, outermost first
+    mutex splitsLock;
+    vector<SplitPoint *> splits;
+};
+
+/**
+ * Young Brothers Wait: a node is shared between threads only after its eldest child has been searched,
+ * as by then its window is known and a cutoff is unlikely. Idle threads join the split points of busy ones
+ * and take the remaining moves, so no thread owns a fixed part of the tree.
+ * Unlike Lazy SMP, the result for a given depth doesn't depend on timing of threads.
+ */
+struct YbwEngine : SearchEngine {
+    TranspositionTable &table;
+    vector<unique_ptr<YbwWorker>> workers;
+    vector<YbwWorker *> team;
+    atomic<int> idleWorkers{0};
+    atomic<bool> teamStop{false};
+    const bool pinThreads;
+
+    YbwEngine(TranspositionTable &table, const int threads, const bool pinThreads) :
+            table(table), pinThreads(pinThreads) {
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back(new YbwWorker(table, i, team, idleWorkers, teamStop));
+            team.push_back(workers.back().get());
+        }
+    }
+
+    pair<int, Move> search(const State &state, const SearchLimits &limits) override {
+        table.newSearch();
+        teamStop = false;
+
+        atomic<bool> searchDone{false};
+        SearchLimits helperLimits = limits;
+        helperLimits.deadline = steady_clock::time_point::max();
+        helperLimits.stop = &teamStop;
+
+        vector<thread> helpers;
+        for (size_t i = 1; i < workers.size(); ++i) {
+            helpers.emplace_back([this, &helperLimits, &searchDone, i]() {
+                if (pinThreads) pinCurrentThread((int) i);
+
+                workers[i]->prepare(helperLimits);
+                workers[i]->help(searchDone);
+            });
+        }
+
+        if (pinThreads) pinCurrentThread(0);
+
+        State mainState = state;
+        const pair<int, Move> result = workers[0]->search(mainState, limits);
+
+        teamStop = true;
+        searchDone = true;
+        for (thread &helper : helpers) helper.join();
+
+        stats = workers[0]->stats;
+        for (size_t i = 1; i < workers.size(); ++i) {
+            stats.nodes += workers[i]->stats.nodes;
+            stats.tableHits += workers[i]->stats.tableHits;
+        }
+
+        return result;
+    }
+};
+
+/******************************************** Monte Carlo tree search *************************************************/
+
+// Playouts stop after this many plies and are scored by the evaluation, as random play rarely ends the game
+static constexpr int MCTS_PLAYOUT_PLIES = 24;
+// Evaluation advantage which turns a playout into about 73% of a win
+static constexpr double MCTS_SCORE_SCALE = 500;
+// The tree stops growing when the arena runs out of nodes
+static constexpr uint32_t MCTS_ARENA_NODES = 1 << 20;
+// Threads take nodes from the arena in chunks of this size, so that allocating children needs no atomics
+static constexpr uint32_t MCTS_CHUNK_NODES = 4096;
+static constexpr uint32_t MCTS_ARENA_CHUNKS = MCTS_ARENA_NODES / MCTS_CHUNK_NODES;
+// Lost playouts counted for a node while a thread is below it, to send other threads elsewhere
+static constexpr uint32_t MCTS_VIRTUAL_LOSS = 3;
+// Rewards are summed as fixed point numbers, as there is no atomic addition of floats
+static constexpr double MCTS_REWARD_UNIT = 1 << 16;
+// The deadline is checked once per this many playouts
+static constexpr uint64_t MCTS_TIME_CHECK_PERIOD = 64;
+
+struct MctsNode {
+    // firstChild of a node which is not expanded, and of a node which some thread is expanding
+    static constexpr uint32_t NOT_EXPANDED = UINT32_MAX;
+    static constexpr uint32_t EXPANDING = UINT32_MAX - 1;
+
+    // Children are consecutive in the arena
+    atomic<uint32_t> firstChild{NOT_EXPANDED};
+    // Written before firstChild is published
+    uint16_t childCount = 0;
+    // Packed move from the parent
+    uint16_t move = 0;
+    // Finished playouts and virtual losses of the ones in progress
+    atomic<uint32_t> visits{0};
+    // Sum of playout rewards for the player who made the move, in MCTS_REWARD_UNIT
+    atomic<uint64_t> reward{0};
+
+    void reset(const uint16_t nodeMove) {
+        firstChild.store(NOT_EXPANDED, memory_order_relaxed);
+        childCount = 0;
+        move = nodeMove;
+        visits.store(0, memory_order_relaxed);
+        reward.store(0, memory_order_relaxed);
+    }
+};
+
+/**
+ * Nodes of search trees, allocated once and handed out to threads in chunks. Chunks are taken in a ring,
+ * each tagged with the generation (search) which took it. Descendants of a node are never older than the node,
+ * so when a later search keeps only the subtree of one node, chunks of all older generations are released at once
+ * by moving the tail of the ring.
+ */
+struct MctsArena {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    unique_ptr<MctsNode[]> nodes{new MctsNode[MCTS_ARENA_NODES]};
+
+    // Chunks ever taken and the first one still in use; both only grow, the chunk index is taken modulo the count
+    atomic<uint64_t> head{0};
+    uint64_t tail = 0;
+
+    uint32_t generation = 0;
+    uint32_t chunkGenerations[MCTS_ARENA_CHUNKS] = {};
+    // Value of head when each generation started
+    vector<uint64_t> generationStarts;
+
+    // Starts a generation; nothing is allocated between searches
+    void newGeneration() {
+        generation = (uint32_t) generationStarts.size();
+        generationStarts.push_back(head.load());
+    }
+
+    // Releases all chunks
+    void clear() {
+        tail = head.load();
+    }
+
+    // Releases chunks of generations older than the one of @param node
+    void keepFrom(const uint32_t node) {
+        tail = generationStarts[chunkGenerations[node / MCTS_CHUNK_NODES]];
+    }
+
+    uint64_t chunksInUse() const {
+        return head.load() - tail;
+    }
+
+    // @return index of the first node of a new chunk, or NONE if the arena is full
+    uint32_t allocateChunk() {
+        uint64_t taken = head.load(memory_order_relaxed);
+        do {
+            if (taken - tail >= MCTS_ARENA_CHUNKS) return NONE;
+        } while (!head.compare_exchange_weak(taken, taken + 1));
+
+        const uint32_t chunk = (uint32_t) (taken % MCTS_ARENA_CHUNKS);
+        chunkGenerations[chunk] = generation;
+        return chunk * MCTS_CHUNK_NODES;
+    }
+};
+
+// Nodes of the chunk a single thread allocates from
+struct MctsAllocator {
+    uint32_t next = 0, end = 0;
+
+    // @return index of the first of @param count new nodes, or NONE if the arena is full
+    uint32_t allocate(MctsArena &arena, const uint32_t count) {
+        if (next + count > end) {
+            next = arena.allocateChunk();
+            if (next == MctsArena::NONE) {
+                next = end = 0;
+                return MctsArena::NONE;
+            }
+            end = next + MCTS_CHUNK_NODES;
+        }
+
+        const uint32_t first = next;
+        next += count;
+        return first;
+    }
+};
+
+// Playout reward of myPlayer for @param score (as stateScore), in (0, 1)
+inline double scoreToReward(const double score) {
+    return 1 / (1 + exp(-score / MCTS_SCORE_SCALE));
+}
+
+inline int rewardToScore(const double reward) {
+    const double clamped = max(1e-6, min(1 - 1e-6, reward));
+    return (int) lround(MCTS_SCORE_SCALE * log(clamped / (1 - clamped)));
+}
+
+/**
+ * UCT search: every iteration descends the tree by the UCB1 formula, expands the leaf on its second visit
+ * and scores it by a short playout.
+ * Threads share the tree without locks: counters are atomic, a node is expanded by the thread which marked it
+ * as expanding first, and virtual losses keep threads from all following the same path.
+ */
+struct MctsEngine : SearchEngine {
+    struct Worker {
+        MctsAllocator allocator;
+        // xorshift64 state of playouts
+        uint64_t random;
+        uint64_t playouts = 0;
+        int depth = 0;
+
+        uint64_t nextRandom() {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            return random;
+        }
+    };
+
+    MctsArena arena;
+    vector<Worker> workers;
+
+    // Root of the last search and its position, kept for the next search
+    uint32_t root = MctsArena::NONE;
+    State rootState;
+
+    // Exploration constant of UCT
+    const double uctExploration;
+    const Config::PlayoutPolicy playoutPolicy;
+    const bool pinThreads;
+
+    MctsEngine(const int threads, const double uctExploration, const Config::PlayoutPolicy playoutPolicy,
+               const bool pinThreads) :
+            workers((size_t) threads), uctExploration(uctExploration), playoutPolicy(playoutPolicy),
+            pinThreads(pinThreads) {
+        for (size_t i = 0; i < workers.size(); ++i) workers[i].random = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    pair<int, Move> search(const State &state, const SearchLimits &limits) override {
+        const steady_clock::time_point start = steady_clock::now();
+        stats = SearchStats();
+
+        for (Worker &worker : workers) {
+            worker.allocator = MctsAllocator();
+            worker.playouts = 0;
+            worker.depth = 0;
+        }
+
+        // The subtree of the position is all that is worth keeping
+        root = findSubtree(state);
+        if (root != MctsArena::NONE) {
+            arena.keepFrom(root);
+            LOG("mcts: reused " << arena.nodes[root].visits << " visits");
+        } else {
+            arena.clear();
+        }
+        arena.newGeneration();
+        rootState = state;
+
+        if (root != MctsArena::NONE) expand(workers[0], root, rootState);
+
+        // A new tree if there is nothing to reuse, or if the reused one has filled the arena before expanding the root
+        if (root == MctsArena::NONE || arena.nodes[root].firstChild.load() >= MctsNode::EXPANDING) {
+            arena.clear();
+            root = workers[0].allocator.allocate(arena, 1);
+            arena.nodes[root].reset(0);
+            expand(workers[0], root, rootState);
+        }
+
+        const MctsNode &rootNode = arena.nodes[root];
+
+        // Only pondering searches finished games, after a predicted reply which ends the game
+        if (rootNode.firstChild.load() >= MctsNode::EXPANDING) {
+            stats.score = stateScore(state);
+            return make_pair(stats.score, NONE_MOVE);
+        }
+
+        if (rootNode.childCount > 1) {
+            atomic<bool> done{false};
+
+            vector<thread> helpers;
+            for (size_t i = 1; i < workers.size(); ++i) {
+                helpers.emplace_back([this, &done, i]() {
+                    if (pinThreads) pinCurrentThread((int) i);
+
+                    while (!done.load(memory_order_relaxed)) iterate(workers[i], rootState);
+                });
+            }
+
+            if (pinThreads) pinCurrentThread(0);
+
+            Worker &main = workers[0];
+            while (main.playouts % MCTS_TIME_CHECK_PERIOD != 0
+                   || ((!limits.stop || !limits.stop->load(memory_order_relaxed))
+                       && steady_clock::now() < limits.deadline)) {
+                iterate(main, rootState);
+            }
+
+            done = true;
+            for (thread &helper : helpers) helper.join();
+        }
+
+        const uint32_t firstChild = rootNode.firstChild;
+        uint32_t best = firstChild;
+        for (uint32_t child = firstChild; child < firstChild + rootNode.childCount; ++child) {
+            if (arena.nodes[child].visits > arena.nodes[best].visits) best = child;
+        }
+
+        for (const Worker &worker : workers) {
+            stats.playouts += worker.playouts;
+            stats.depth = max(stats.depth, worker.depth);
+        }
+
+        const MctsNode &bestNode = arena.nodes[best];
+        stats.score = bestNode.visits ? rewardToScore(meanReward(bestNode)) : stateScore(state);
+        stats.nodes = arena.chunksInUse() * MCTS_CHUNK_NODES;
+
+        const double seconds = duration<double>(steady_clock::now() - start).count();
+        stats.playoutsPerSecond = (uint64_t) (stats.playouts / max(seconds, 1e-9));
+
+        return make_pair(stats.score, unpackMove(bestNode.move));
+    }
+
+private:
+    /**
+     * Node of the last tree with the position @param state: its root if the position is the same (a ponder hit),
+     * or a grandchild if our move and the enemy reply led to it.
+     * @return the node or NONE
+     */
+    uint32_t findSubtree(const State &state) const {
+        if (root == MctsArena::NONE || state.myPlayer != rootState.myPlayer) return MctsArena::NONE;
+
+        const uint64_t key = state.key();
+        if (rootState.doneSteps == state.doneSteps && rootState.key() == key) return root;
+        if (rootState.doneSteps + 2 != state.doneSteps) return MctsArena::NONE;
+
+        const MctsNode &rootNode = arena.nodes[root];
+        const uint32_t firstChild = rootNode.firstChild;
+        if (firstChild >= MctsNode::EXPANDING) return MctsArena::NONE;
+
+        for (uint32_t child = firstChild; child < firstChild + rootNode.childCount; ++child) {
+            State afterMove = rootState;
+            afterMove.doMove(unpackMove(arena.nodes[child].move));
+
+            const MctsNode &childNode = arena.nodes[child];
+            const uint32_t firstGrandchild = childNode.firstChild;
+            if (firstGrandchild >= MctsNode::EXPANDING) continue;
+
+            for (uint32_t grandchild = firstGrandchild; grandchild < firstGrandchild + childNode.childCount;
+                 ++grandchild) {
+                State afterReply = afterMove;
+                afterReply.doMove(unpackMove(arena.nodes[grandchild].move));
+                if (afterReply.key() == key) return grandchild;
+            }
+        }
+
+        return MctsArena::NONE;
+    }
+
+    static double meanReward(const MctsNode &node) {
+        return (double) node.reward.load(memory_order_relaxed) / MCTS_REWARD_UNIT
+               / node.visits.load(memory_order_relaxed);
+    }
+
+    void iterate(Worker &worker, const State &rootState) {
+        State state = rootState;
+
+        // Nodes from the root and players who made their moves
+        uint32_t path[MAX_PLY + 1];
+        int movers[MAX_PLY + 1];
+        int length = 0;
+
+        uint32_t node = root;
+        path[length++] = node;
+        uint32_t previousVisits = 0;
+
+        while (length <= MAX_PLY) {
+            const uint32_t firstChild = arena.nodes[node].firstChild.load(memory_order_acquire);
+            if (firstChild >= MctsNode::EXPANDING) break;
+
+            node = select(node, firstChild);
+            previousVisits = arena.nodes[node].visits.fetch_add(MCTS_VIRTUAL_LOSS, memory_order_relaxed);
+
+            movers[length] = state.currentPlayer;
+            state.doMove(unpackMove(arena.nodes[node].move));
+            path[length++] = node;
+        }
+
+        // Leaves are expanded on the second visit, most of them are never visited again
+        if (previousVisits > 0 && length <= MAX_PLY && expand(worker, node, state)) {
+            node = arena.nodes[node].firstChild.load(memory_order_relaxed);
+            arena.nodes[node].visits.fetch_add(MCTS_VIRTUAL_LOSS, memory_order_relaxed);
+
+            movers[length] = state.currentPlayer;
+            state.doMove(unpackMove(arena.nodes[node].move));
+            path[length++] = node;
+        }
+
+        const double reward = playout(worker, state);
+        worker.playouts++;
+        worker.depth = max(worker.depth, length - 1);
+
+        // Virtual losses become one real visit
+        arena.nodes[root].visits.fetch_add(1, memory_order_relaxed);
+        for (int i = 1; i < length; ++i) {
+            MctsNode &pathNode = arena.nodes[path[i]];
+            const double playerReward = movers[i] == rootState.myPlayer ? reward : 1 - reward;
+
+            pathNode.reward.fetch_add((uint64_t) (playerReward * MCTS_REWARD_UNIT), memory_order_relaxed);
+            pathNode.visits.fetch_sub(MCTS_VIRTUAL_LOSS - 1, memory_order_relaxed);
+        }
+    }
+
+    // Child of @param node with the best UCB1 value; unvisited children first
+    uint32_t select(const uint32_t node, const uint32_t firstChild) const {
+        const MctsNode &parent = arena.nodes[node];
+        const double exploration =
+                uctExploration * sqrt(log((double) parent.visits.load(memory_order_relaxed) + 1));
+
+        uint32_t best = firstChild;
+        double bestValue = -1;
+        for (uint32_t child = firstChild; child < firstChild + parent.childCount; ++child) {
+            const MctsNode &childNode = arena.nodes[child];
+            const uint32_t visits = childNode.visits.load(memory_order_relaxed);
+            if (visits == 0) return child;
+
+            const double value = meanReward(childNode) + exploration / sqrt((double) visits);
+            if (value > bestValue) {
+                bestValue = value;
+                best = child;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Adds children to @param node, unless another thread is doing that.
+     * @return false if the node has no moves, is being expanded or the arena is full
+     */
+    bool expand(Worker &worker, const uint32_t node, State &state) {
+        if (isGameOver(state)) return false;
+
+        MctsNode &parent = arena.nodes[node];
+        uint32_t unexpanded = MctsNode::NOT_EXPANDED;
+        if (!parent.firstChild.compare_exchange_strong(unexpanded, MctsNode::EXPANDING)) return false;
+
+        MoveList moves;
+        allAvailableMoves(state, moves);
+        if (moves.empty()) moves.push_back(NONE_MOVE);
+
+        const uint32_t first = worker.allocator.allocate(arena, (uint32_t) moves.count);
+        if (first == MctsArena::NONE) {
+            parent.firstChild.store(MctsNode::NOT_EXPANDED, memory_order_relaxed);
+            return false;
+        }
+
+        for (int i = 0; i < moves.count; ++i) arena.nodes[first + i].reset(packMove(moves.moves[i]));
+        parent.childCount = (uint16_t) moves.count;
+        parent.firstChild.store(first, memory_order_release);
+        return true;
+    }
+
+    // Plays from @param state by the playout policy, @return reward of myPlayer
+    double playout(Worker &worker, State &state) {
+        MoveList moves;
+        for (int ply = 0; ply < MCTS_PLAYOUT_PLIES && !isGameOver(state); ++ply) {
+            moves.count = 0;
+            if (playoutPolicy == Config::GREEDY_PLAYOUT) {
+                // Captures are what matters, and there are few of them
+                generateMoves(state, CAPTURE_MOVES, moves);
+                if (moves.empty()) allAvailableMoves(state, moves);
+            } else {
+                allAvailableMoves(state, moves);
+            }
+
+            state.doMove(moves.empty() ? NONE_MOVE : moves.moves[worker.nextRandom() % moves.count]);
+        }
+
+        return scoreToReward(stateScore(state));
+    }
+};
+
+/******************************************** engine choice ***********************************************************/
+
+// Engine chosen by @param settings; alpha-beta engines use @param table
+SearchEngine *createEngine(const Config &settings, TranspositionTable &table) {
+    if (settings.engine == Config::MONTE_CARLO)
+        return new MctsEngine(settings.threads, settings.uctExploration, settings.playoutPolicy, settings.pinThreads);
+    if (settings.parallelSearch == Config::YOUNG_BROTHERS_WAIT)
+        return new YbwEngine(table, settings.threads, settings.pinThreads);
+    return new LazySmpEngine(table, settings.threads, settings.pinThreads);
+}
+
+SearchEngine &sharedEngine() {
+    static unique_ptr<SearchEngine> engine(createEngine(config, sharedTable()));
+    return *engine;
+}
+
+/******************************************** pondering ***************************************************************/
+
+/**
+ * Searches the position after the predicted enemy reply in a background thread, while mainLoop waits for the reply.
+ * The search runs until the reply arrives. If the prediction was right, time spent pondering counts as spent
+ * on the move, and a long enough ponder is played at once.
+ */
+struct Ponderer {
+    thread worker;
+    // Position after the predicted reply, with myPlayer to move
+    State state;
+    pair<int, Move> result;
+    int depth = 0;
+    steady_clock::time_point startTime, stopTime;
+    atomic<bool> stopFlag{false};
+
+    void start(const State &afterOwnMove) {
+        startTime = steady_clock::now();
+        state = afterOwnMove;
+
+        const Move reply = predictReply(state);
+        state.doMove(reply);
+
+        stopFlag = false;
+        depth = 0;
+
+        worker = thread([this]() {
+            SearchLimits limits;
+            limits.deadline = steady_clock::time_point::max();
+            limits.stop = &stopFlag;
+
+            SearchEngine &engine = sharedEngine();
+            result = engine.search(state, limits);
+            depth = engine.stats.depth;
+        });
+    }
+
+    // Aborts the search and waits for it to finish; does nothing if not pondering
+    void stop() {
+        if (!worker.joinable()) return;
+
+        stopFlag = true;
+        stopTime = steady_clock::now();
+        worker.join();
+    }
+
+    /**
+     * Takes the result of the last pondering if it searched @param actual: moves the deadline of @param limits
+     * back by the pondering time, and if that leaves no time, sets @param move to the pondered move.
+     * @return whether the pondered move is to be played
+     */
+    bool take(const State &actual, SearchLimits &limits, Move &move) {
+        if (depth == 0 || actual.doneSteps != state.doneSteps || actual.key() != state.key()) return false;
+
+        const steady_clock::duration pondered = stopTime - startTime;
+        LOG("step " << actual.doneSteps << ": ponder hit " << result.second << " depth " << depth
+                    << " score " << result.first << " after " << duration_cast<milliseconds>(pondered).count()
+                    << " ms");
+
+        depth = 0;
+        limits.deadline -= pondered;
+        move = result.second;
+        return steady_clock::now() >= limits.deadline;
+    }
+
+private:
+    // Best reply found by the last search if the table still has it, otherwise the best one by static evaluation
+    static Move predictReply(State &state) {
+        MoveList replies;
+        allAvailableMoves(state, replies);
+        if (replies.empty()) return NONE_MOVE;
+
+        TranspositionTable::Entry entry{};
+        if (sharedTable().probe(state.key(), entry)) {
+            const Move move = unpackMove(entry.move);
+            if (find(replies.begin(), replies.end(), move) != replies.end()) return move;
+        }
+
+        int scores[MoveList::CAPACITY];
+        sortByEvaluation(state, replies, scores);
+        return replies.moves[0];
+    }
+};
+
+Ponderer ponderer; // NOLINT(cert-err58-cpp)
+
+void startPondering(const State &state) {
+    if (!isGameOver(state)) ponderer.start(state);
+}
+
+void stopPondering() {
+    ponderer.stop();
+}
+
+/******************************************** doMove ******************************************************************/
+
+/**
+ * Magician swaps which bring acrobat or clowns to houses, played without searching.
+ * @return false if none applies
+ */
+bool magicianMove(const State &state, Move &out) {
+    Entity acrobat = Entity(state.myPlayer, Entity::ACROBAT);
+    Entity magician = Entity(state.myPlayer, Entity::MAGICIAN);
+    Entity clown1 = Entity(state.myPlayer, Entity::CLOWN, false);
+    Entity clown2 = Entity(state.myPlayer, Entity::CLOWN, true);
+
+    if (distanceToNearestHouse(state, acrobat) <= 2 && distanceToNearestHouse(state, magician) > 2) {
+        const Move move = Move{
+                state.field.positions[magician.id],
+                state.field.positions[acrobat.id]};
+
+        if (state.field.checkMove(move)) {
+            out = move;
+            return true;
+        }
+    }
+
+    if (distanceToNearestHouse(state, magician) <= 2) {
+        if (distanceToNearestHouse(state, clown1) > 2) {
+            const Move move = Move{
+                    state.field.positions[magician.id],
+                    state.field.positions[clown1.id]};
+
+            if (state.field.checkMove(move)) {
+                out = move;
+                return true;
+            }
+        }
+        if (distanceToNearestHouse(state, clown2) > 2) {
+            const Move move = Move{
+                    state.field.positions[magician.id],
+                    state.field.positions[clown2.id]};
+
+            if (state.field.checkMove(move)) {
+                out = move;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+Move doMove(const State &state) {
+
+    SearchLimits limits;
+    limits.deadline = steady_clock::now() + config.moveTime;
+    limits.maxDepth = config.maxDepth;
+
+    Move move;
+    if (magicianMove(state, move)) return move;
+
+    Move ponderMove;
+    if (ponderer.take(state, limits, ponderMove)) return ponderMove;
+
+    SearchEngine &engine = sharedEngine();
+    auto moveInfo = engine.search(state, limits);
+
+    LOG("step " << state.doneSteps << ": " << moveInfo.second << " depth " << engine.stats.depth
+                << " score " << engine.stats.score << " nodes " << engine.stats.nodes
+                << " table hits " << engine.stats.tableHits
+                << " cutoffs " << engine.stats.cutoffs << " (1st " << engine.stats.firstMoveCutoffs
+                << ", 2nd " << engine.stats.secondMoveCutoffs << ", hash " << engine.stats.hashMoveCutoffs
+                << ", killer " << engine.stats.killerCutoffs << ", history " << engine.stats.historyCutoffs << ")"
+                << " re-searches " << engine.stats.aspirationResearches << " aspiration, "
+                << engine.stats.pvsResearches << " pvs"
+                << " quiescence nodes " << engine.stats.quiescenceNodes
+                << " playouts " << engine.stats.playouts << " (" << engine.stats.playoutsPerSecond << "/s)");
+
+
+    return moveInfo.second;
+}
+
+/******************************************** reference positions *****************************************************/
+
+// Start positions of tools which check and measure the solution
+struct ReferencePosition {
+    const char *name;
+    // Game input: houses and my player
+    const char *input;
+
+    State state() const {
+        State out;
+        stringstream in(input);
+        in >> out;
+        return out;
+    }
+};
+
+const ReferencePosition REFERENCE_POSITIONS[] = {
+        {"middle", "F1 F2 F3 F4 F5 F6 F7 F8 F9 D5 E5 G5 H5 0"},
+        {"near", "D1 D2 D3 C3 C4 B4 B5 B6 C6 C7 D7 D8 D9 0"},
+        {"scattered", "E2 H3 K1 G6 J8 L5 D9 I4 F7 K7 E4 H9 L2 0"},
+        {"far", "J1 J3 J5 J7 J9 K2 K4 K6 K8 L1 L3 L7 L9 0"},
+};
+
+static constexpr int REFERENCE_POSITIONS_COUNT = sizeof(REFERENCE_POSITIONS) / sizeof(REFERENCE_POSITIONS[0]);
+
+#ifdef PERFT
+/******************************************** perft *******************************************************************/
+
+/**
+ * Walks the move tree of reference positions to a fixed depth, counting leaves, to check move generation
+ * and doMove for exactness and speed. Finished games are leaves, and a player without moves passes with NONE_MOVE.
+ */
+static constexpr int PERFT_KNOWN_DEPTH = 5;
+
+// Leaves of each reference position at depths from 1 to PERFT_KNOWN_DEPTH
+const uint64_t PERFT_EXPECTED_LEAVES[REFERENCE_POSITIONS_COUNT][PERFT_KNOWN_DEPTH] = {
+        {23, 534, 14136, 377393, 10999776},
+        {19, 364, 7429, 152916, 3249500},
+        {23, 534, 14114, 372304, 10824372},
+        {23, 534, 14158, 378697, 11095874},
+};
+
+struct PerftCounter {
+    uint64_t leaves = 0;
+    // Moves done, that is nodes below the root
+    uint64_t nodes = 0;
+
+    void walk(State &state, const int depth) {
+        if (depth == 0 || isGameOver(state)) {
+            ++leaves;
+            return;
+        }
+
+        MoveList moves;
+        allAvailableMoves(state, moves);
+        if (moves.empty()) moves.push_back(NONE_MOVE);
+
+        for (const Move move : moves) {
+            const Field::Undo undo = state.doMove(move);
+            ++nodes;
+            walk(state, depth - 1);
+            state.undoMove(undo);
+        }
+    }
+};
+
+struct PerftOptions {
+    int depth = 4;
+    int threads = 1;
+    // Print leaves below each root move
+    bool divide = false;
+    // Notation of the position to walk instead of the reference ones
+    string position;
+};
+
+// Root moves are handed out to threads one at a time
+PerftCounter perftDivide(const State &root, const int depth, const int threads, vector<uint64_t> &rootLeaves) {
+    MoveList moves;
+    allAvailableMoves(root, moves);
+    if (moves.empty()) moves.push_back(NONE_MOVE);
+
+    rootLeaves.assign(moves.count, 0);
+    vector<PerftCounter> counters(threads);
+    atomic<int> nextMove{0};
+
+    const auto work = [&](const int index) {
+        State state = root;
+        for (int i = nextMove++; i < moves.count; i = nextMove++) {
+            PerftCounter counter;
+            const Field::Undo undo = state.doMove(moves.moves[i]);
+            counter.walk(state, depth - 1);
+            state.undoMove(undo);
+
+            rootLeaves[i] = counter.leaves;
+            counters[index].leaves += counter.leaves;
+            counters[index].nodes += counter.nodes + 1;
+        }
+    };
+
+    vector<thread> helpers;
+    for (int i = 1; i < threads; ++i) helpers.emplace_back(work, i);
+    work(0);
+    for (thread &helper : helpers) helper.join();
+
+    PerftCounter total;
+    for (const PerftCounter &counter : counters) {
+        total.leaves += counter.leaves;
+        total.nodes += counter.nodes;
+    }
+    return total;
+}
+
+// Arguments: --depth=<plies> --threads=<count> --divide --position=<notation>.
+// @return 1 if any leaf count differs from the expected one
+int perftMain(const int argc, char **argv) {
+    PerftOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const pair<string, string> argument = splitArgument(argv[i]);
+
+        if (argument.first == "--depth") options.depth = max(1, stoi(argument.second));
+        else if (argument.first == "--threads") options.threads = max(1, stoi(argument.second));
+        else if (argument.first == "--divide") options.divide = argument.second != "0";
+        else if (argument.first == "--position") options.position = argument.second;
+        else cerr << "Unknown argument " << argv[i] << endl;
+    }
+
+    const bool custom = !options.position.empty();
+    State customState;
+    if (custom && !parseNotation(options.position, customState)) {
+        cerr << "Malformed position " << options.position << endl;
+        return 2;
+    }
+
+    bool allMatch = true;
+    uint64_t totalNodes = 0;
+    const steady_clock::time_point start = steady_clock::now();
+
+    for (int index = 0; index < (custom ? 1 : REFERENCE_POSITIONS_COUNT); ++index) {
+        const State state = custom ? customState : REFERENCE_POSITIONS[index].state();
+        const char *name = custom ? "position" : REFERENCE_POSITIONS[index].name;
+
+        const steady_clock::time_point positionStart = steady_clock::now();
+        vector<uint64_t> rootLeaves;
+        const PerftCounter counter = perftDivide(state, options.depth, options.threads, rootLeaves);
+        const double seconds = duration<double>(steady_clock::now() - positionStart).count();
+        totalNodes += counter.nodes;
+
+        cout << name << ": depth " << options.depth << " leaves " << counter.leaves
+             << " nodes " << counter.nodes << " time " << seconds << "s nps " << (uint64_t) (counter.nodes / seconds);
+
+        if (!custom && options.depth <= PERFT_KNOWN_DEPTH) {
+            const uint64_t expected = PERFT_EXPECTED_LEAVES[index][options.depth - 1];
+            const bool match = counter.leaves == expected;
+            allMatch &= match;
+            cout << (match ? " ok" : " MISMATCH, expected ") << (match ? "" : to_string(expected));
+        }
+        cout << endl;
+
+        if (options.divide) {
+            MoveList moves;
+            allAvailableMoves(state, moves);
+            if (moves.empty()) moves.push_back(NONE_MOVE);
+
+            for (int i = 0; i < moves.count; ++i) cout << "  " << moves.moves[i] << ": " << rootLeaves[i] << endl;
+        }
+    }
+
+    const double seconds = duration<double>(steady_clock::now() - start).count();
+    cout << "total: nodes " << totalNodes << " time " << seconds << "s nps " << (uint64_t) (totalNodes / seconds)
+         << " threads " << options.threads << endl;
+
+    return allMatch ? 0 : 1;
+}
+#endif
+
+#ifdef BENCH
+/******************************************** bench *******************************************************************/
+
+/**
+ * Times hot primitives in isolation over a corpus of positions from random games of reference positions.
+ * Each primitive is run over the whole corpus repeatedly; every run gives ns/op, and min, median and p99 of runs
+ * are reported, so that versions can be compared.
+ */
+static constexpr int BENCH_SNAPSHOT_PLIES = 8;
+// A run repeats passes over the corpus until it takes at least this long, so that the clock is precise enough
+static constexpr nanoseconds BENCH_MIN_RUN_TIME = microseconds(500);
+
+struct BenchCorpus {
+    vector<State> states;
+    // Moves of the player to move in each state
+    vector<MoveList> moves;
+    // checkMove inputs: each entity of the player to move to each cell at most 2 rows and columns away
+    vector<vector<Move>> candidates;
+};
+
+void addToCorpus(BenchCorpus &corpus, const State &state) {
+    MoveList moves;
+    allAvailableMoves(state, moves);
+
+    vector<Move> candidates;
+    for (int entityId = state.currentPlayer << 3; entityId < (state.currentPlayer << 3) + 7; ++entityId) {
+        const Cell from = state.field.positions[entityId];
+
+        for (int row = from.row - 2; row <= from.row + 2; ++row) {
+            for (int col = from.col - 2; col <= from.col + 2; ++col) candidates.push_back(Move{from, {row, col}});
+        }
+    }
+
+    corpus.states.push_back(state);
+    corpus.moves.push_back(moves);
+    corpus.candidates.push_back(candidates);
+}
+
+// Snapshots every BENCH_SNAPSHOT_PLIES plies of a random game from each reference position
+BenchCorpus buildBenchCorpus(uint64_t seed) {
+    BenchCorpus corpus;
+
+    for (const ReferencePosition &position : REFERENCE_POSITIONS) {
+        State state = position.state();
+
+        for (int ply = 0; !isGameOver(state); ++ply) {
+            if (ply % BENCH_SNAPSHOT_PLIES == 0) addToCorpus(corpus, state);
+
+            MoveList moves;
+            allAvailableMoves(state, moves);
+            state.doMove(moves.empty() ? NONE_MOVE : moves.moves[splitMix64(seed) % moves.count]);
+        }
+    }
+
+    return corpus;
+}
+
+// Positions in notation, one per line. @return false if the file has a malformed line
+bool loadBenchCorpus(const string &fileName, BenchCorpus &corpus) {
+    ifstream in(fileName);
+    string line;
+
+    while (getline(in, line)) {
+        if (line.empty()) continue;
+
+        State state;
+        if (!parseNotation(line, state)) return false;
+        addToCorpus(corpus, state);
+    }
+
+    return !corpus.states.empty();
+}
+
+struct BenchResult {
+    string name;
+    uint64_t opsPerRun = 0;
+    double minNs = 0, medianNs = 0, p99Ns = 0;
+};
+
+// Keeps results of benchmarked calls alive
+volatile uint64_t benchSink = 0;
+
+/**
+ * @param pass does the operation over the corpus once and returns the number of operations done
+ */
+BenchResult measure(const string &name, const int runs, const function<uint64_t()> &pass) {
+    int repeats = 1;
+    while (repeats < (1 << 20)) {
+        const steady_clock::time_point start = steady_clock::now();
+        for (int i = 0; i < repeats; ++i) pass();
+        if (steady_clock::now() - start >= BENCH_MIN_RUN_TIME) break;
+        repeats *= 2;
+    }
+
+    BenchResult result;
+    result.name = name;
+
+    vector<double> nsPerOp;
+    for (int run = 0; run < runs; ++run) {
+        uint64_t ops = 0;
+        const steady_clock::time_point start = steady_clock::now();
+        for (int i = 0; i < repeats; ++i) ops += pass();
+        nsPerOp.push_back(duration<double, nano>(steady_clock::now() - start).count() / (double) ops);
+        result.opsPerRun = ops;
+    }
+
+    sort(nsPerOp.begin(), nsPerOp.end());
+    result.minNs = nsPerOp.front();
+    result.medianNs = nsPerOp[nsPerOp.size() / 2];
+    result.p99Ns = nsPerOp[min(nsPerOp.size() - 1, (size_t) ceil(0.99 * (double) nsPerOp.size()) - 1)];
+    return result;
+}
+
+const char *simdLevelName(const SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_SSE41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    }
+}
+
+// Arguments: --runs=<count> --seed=<number> --json=<file> --corpus=<file of positions in notation>
+int benchMain(const int argc, char **argv) {
+    int runs = 101;
+    uint64_t seed = 1;
+    string jsonFile, corpusFile;
+
+    for (int i = 1; i < argc; ++i) {
+        const pair<string, string> argument = splitArgument(argv[i]);
+
+        if (argument.first == "--runs") runs = max(1, stoi(argument.second));
+        else if (argument.first == "--seed") seed = stoull(argument.second);
+        else if (argument.first == "--json") jsonFile = argument.second;
+        else if (argument.first == "--corpus") corpusFile = argument.second;
+        else cerr << "Unknown argument " << argv[i] << endl;
+    }
+
+    BenchCorpus corpus;
+    if (corpusFile.empty()) {
+        corpus = buildBenchCorpus(seed);
+    } else if (!loadBenchCorpus(corpusFile, corpus)) {
+        cerr << "Can't load positions from " << corpusFile << endl;
+        return 2;
+    }
+    vector<State> copies(corpus.states.size());
+    const size_t positions = corpus.states.size();
+
+    vector<BenchResult> results;
+
+    results.push_back(measure("checkMove", runs, [&]() {
+        uint64_t ops = 0, sum = 0;
+        for (size_t i = 0; i < positions; ++i) {
+            for (const Move move : corpus.candidates[i]) sum += corpus.states[i].field.checkMove(move);
+            ops += corpus.candidates[i].size();
+        }
+        benchSink += sum;
+        return ops;
+    }));
+
+    results.push_back(measure("doMove+undoMove", runs, [&]() {
+        uint64_t ops = 0, sum = 0;
+        for (size_t i = 0; i < positions; ++i) {
+            Field &field = corpus.states[i].field;
+            for (const Move move : corpus.moves[i]) {
+                const Field::Undo undo = field.doMove(move);
+                sum += field.hash;
+                field.undoMove(undo);
+            }
+            ops += corpus.moves[i].count;
+        }
+        benchSink += sum;
+        return ops;
+    }));
+
+    results.push_back(measure("allAvailableMoves", runs, [&]() {
+        uint64_t sum = 0;
+        MoveList moves;
+        for (size_t i = 0; i < positions; ++i) {
+            allAvailableMoves(corpus.states[i], moves);
+            sum += moves.count;
+        }
+        benchSink += sum;
+        return positions;
+    }));
+
+    results.push_back(measure("stateScore", runs, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < positions; ++i) sum += stateScore(corpus.states[i]);
+        benchSink += sum;
+        return positions;
+    }));
+
+    results.push_back(measure("fullStateScore", runs, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < positions; ++i) sum += fullStateScore(corpus.states[i]);
+        benchSink += sum;
+        return positions;
+    }));
+
+    results.push_back(measure("distanceToNearestHouse", runs, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < positions; ++i) {
+            for (int cell = 0; cell < FIELD_CELLS; ++cell)
+                sum += distanceToNearestHouse(corpus.states[i], Cell::byIndex(cell));
+        }
+        benchSink += sum;
+        return positions * FIELD_CELLS;
+    }));
+
+    results.push_back(measure("rebuildHouseDistances", runs, [&]() {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < positions; ++i) {
+            corpus.states[i].field.rebuildHouseDistances();
+            sum += corpus.states[i].field.houseDistances[0];
+        }
+        benchSink += sum;
+        return positions;
+    }));
+
+    results.push_back(measure("State copy", runs, [&]() {
+        for (size_t i = 0; i < positions; ++i) copies[i] = corpus.states[i];
+        benchSink += copies[positions / 2].field.hash;
+        return positions;
+    }));
+
+    cout << "positions " << positions << ", runs " << runs << ", simd " << simdLevelName(SIMD_LEVEL) << endl;
+    cout << left << setw(24) << "benchmark" << right << setw(12) << "ops/run"
+         << setw(12) << "min ns" << setw(12) << "median ns" << setw(12) << "p99 ns" << endl;
+    cout << fixed << setprecision(2);
+    for (const BenchResult &result : results) {
+        cout << left << setw(24) << result.name << right << setw(12) << result.opsPerRun
+             << setw(12) << result.minNs << setw(12) << result.medianNs << setw(12) << result.p99Ns << endl;
+    }
+
+    if (!jsonFile.empty()) {
+        ofstream json(jsonFile);
+        json << fixed << setprecision(3);
+        json << "{\n  \"positions\": " << positions << ",\n  \"runs\": " << runs
+             << ",\n  \"simd\": \"" << simdLevelName(SIMD_LEVEL) << "\",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult &result = results[i];
+            json << "    {\"name\": \"" << result.name << "\", \"ops_per_run\": " << result.opsPerRun
+                 << ", \"min_ns\": " << result.minNs << ", \"median_ns\": " << result.medianNs
+                 << ", \"p99_ns\": " << result.p99Ns << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        json << "  ]\n}\n";
+    }
+
+    return 0;
+}
+#endif
+
+#ifdef POSGEN
+/******************************************** position generator ******************************************************/
+
+/**
+ * Writes positions sampled from seeded random games of reference positions, deduplicated by key, for corpora of
+ * benchmarks and tests. Game g depends only on the seed and g, and games are merged in order of their numbers,
+ * so the output doesn't depend on the number of threads.
+ */
+static constexpr uint64_t POSGEN_GAME_SEED_STEP = 0x9E3779B97F4A7C15ull;
+// Relative chance of a move of each stage to be played by the weighted policy
+static constexpr int POSGEN_STAGE_WEIGHTS[STAGES_COUNT] = {8, 2, 1};
+
+struct PosgenOptions {
+    size_t count = 10000;
+    uint64_t seed = 1;
+    int threads = 1;
+    // Positions are sampled at plies from minPly to maxPly which are multiples of every
+    int minPly = 8;
+    int maxPly = MAX_STEPS - 1;
+    int every = 4;
+    // Choose captures, pushes and swaps more often than quiet moves, see POSGEN_STAGE_WEIGHTS
+    bool weighted = false;
+    bool binary = false;
+    // Standard output if empty
+    string output;
+};
+
+// Position sampled from a game
+struct PosgenSample {
+    uint64_t key;
+    State state;
+};
+
+Move choosePosgenMove(const State &state, const bool weighted, uint64_t &seed) {
+    MoveList stages[STAGES_COUNT];
+    int totalWeight = 0;
+
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        generateMoves(state, (MoveStage) stage, stages[stage]);
+        totalWeight += stages[stage].count * (weighted ? POSGEN_STAGE_WEIGHTS[stage] : 1);
+    }
+    if (totalWeight == 0) return NONE_MOVE;
+
+    int choice = (int) (splitMix64(seed) % (uint64_t) totalWeight);
+    for (int stage = 0;; ++stage) {
+        const int weight = weighted ? POSGEN_STAGE_WEIGHTS[stage] : 1;
+        if (choice < stages[stage].count * weight) return stages[stage].moves[choice / weight];
+        choice -= stages[stage].count * weight;
+    }
+}
+
+void playPosgenGame(const PosgenOptions &options, const uint64_t game, vector<PosgenSample> &out) {
+    uint64_t seed = options.seed + game * POSGEN_GAME_SEED_STEP;
+    State state = REFERENCE_POSITIONS[game % REFERENCE_POSITIONS_COUNT].state();
+
+    for (int ply = 0; ply <= options.maxPly && !isGameOver(state); ++ply) {
+        if (ply >= options.minPly && ply % options.every == 0) out.push_back(PosgenSample{state.key(), state});
+        state.doMove(choosePosgenMove(state, options.weighted, seed));
+    }
+}
+
+// Arguments: --count=<positions> --seed=<number> --threads=<count> --min-ply=<ply> --max-ply=<ply> --every=<plies>
+// --policy=random|weighted --format=text|binary --output=<file>
+int posgenMain(const int argc, char **argv) {
+    PosgenOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const pair<string, string> argument = splitArgument(argv[i]);
+        const string &name = argument.first,
+                &value = argument.second;
+
+        if (name == "--count") options.count = stoul(value);
+        else if (name == "--seed") options.seed = stoull(value);
+        else if (name == "--threads") options.threads = max(1, stoi(value));
+        else if (name == "--min-ply") options.minPly = max(0, stoi(value));
+        else if (name == "--max-ply") options.maxPly = min(MAX_STEPS - 1, stoi(value));
+        else if (name == "--every") options.every = max(1, stoi(value));
+        else if (name == "--policy" && value == "random") options.weighted = false;
+        else if (name == "--policy" && value == "weighted") options.weighted = true;
+        else if (name == "--format" && value == "text") options.binary = false;
+        else if (name == "--format" && value == "binary") options.binary = true;
+        else if (name == "--output") options.output = value;
+        else cerr << "Unknown argument " << argv[i] << endl;
+    }
+
+    if (options.minPly > options.maxPly) {
+        cerr << "No plies to sample" << endl;
+        return 2;
+    }
+
+    const steady_clock::time_point start = steady_clock::now();
+
+    vector<State> positions;
+    unordered_set<uint64_t> keys;
+    uint64_t nextGame = 0;
+    // Stop if games keep repeating known positions
+    int fruitlessRounds = 0;
+
+    while (positions.size() < options.count && fruitlessRounds < 8) {
+        // Enough games for the rest of positions, guessing that a game gives a sample per every plies
+        const uint64_t samplesPerGame = max(1, (options.maxPly - options.minPly) / options.every),
+                games = max((uint64_t) options.threads,
+                            min((uint64_t) 4096, (options.count - positions.size()) / samplesPerGame + 1));
+
+        vector<vector<PosgenSample>> samples(games);
+        atomic<uint64_t> nextIndex{0};
+
+        const auto work = [&]() {
+            for (uint64_t index = nextIndex++; index < games; index = nextIndex++)
+                playPosgenGame(options, nextGame + index, samples[index]);
+        };
+
+        vector<thread> helpers;
+        for (int i = 1; i < options.threads; ++i) helpers.emplace_back(work);
+        work();
+        for (thread &helper : helpers) helper.join();
+
+        const size_t knownPositions = positions.size();
+        for (const vector<PosgenSample> &game : samples) {
+            for (const PosgenSample &sample : game) {
+                if (positions.size() == options.count) break;
+                if (keys.insert(sample.key).second) positions.push_back(sample.state);
+            }
+        }
+
+        nextGame += games;
+        fruitlessRounds = positions.size() == knownPositions ? fruitlessRounds + 1 : 0;
+    }
+
+    ofstream file;
+    if (!options.output.empty()) file.open(options.output, options.binary ? ios::binary : ios::out);
+    ostream &out = options.output.empty() ? cout : file;
+
+    for (const State &state : positions) {
+        if (options.binary) {
+            const PackedPosition packed = packPosition(state);
+            out.write((const char *) packed.bytes, PackedPosition::SIZE);
+        } else {
+            out << toNotation(state) << '\n';
+        }
+    }
+    out.flush();
+
+    cerr << positions.size() << " positions from " << nextGame << " games in "
+         << duration<double>(steady_clock::now() - start).count() << "s" << endl;
+
+    return positions.size() == options.count ? 0 : 1;
+}
+#endif
+
+#ifdef ARENA
+/******************************************** arena *******************************************************************/
+
+/**
+ * Referee which plays two engines against each other in one process, many games at a time.
+ * Each house layout is played twice with colours swapped. Game g depends only on the seed and g,
+ * and depth-limited single-threaded engines are deterministic, so such matches can be repeated exactly.
+ */
+static constexpr int ARENA_HOUSES = 13;
+static constexpr int ARENA_DEFAULT_DEPTH = 3;
+static constexpr milliseconds ARENA_DEFAULT_MOVE_TIME{1000};
+
+struct ArenaOptions {
+    int games = 100;
+    int threads = (int) max(1u, thread::hardware_concurrency());
+    uint64_t seed = 1;
+    // Engine settings of both sides, parsed like the arguments of the solution
+    Config players[2];
+    // Result of each game, if not empty
+    string log;
+
+    ArenaOptions() {
+        for (Config &player : players) {
+            player.maxDepth = ARENA_DEFAULT_DEPTH;
+            player.moveTime = ARENA_DEFAULT_MOVE_TIME;
+        }
+    }
+};
+
+// Engine with its own table, playing like doMove, but without pondering
+struct ArenaPlayer {
+    const Config &settings;
+    TranspositionTable table;
+    unique_ptr<SearchEngine> engine;
+
+    explicit ArenaPlayer(const Config &settings) :
+            settings(settings), table(settings.hashMegabytes), engine(createEngine(settings, table)) {}
+
+    Move move(const State &state) {
+        Move move;
+        if (magicianMove(state, move)) return move;
+
+        SearchLimits limits;
+        limits.deadline = steady_clock::now() + settings.moveTime;
+        limits.maxDepth = settings.maxDepth;
+        return engine->search(state, limits).second;
+    }
+};
+
+struct ArenaGame {
+    // Player (colour) of the first engine
+    int firstPlayer = 0;
+    // Houses taken by each player
+    int houses[2] = {};
+    // Player who won or -1 for a draw
+    int winner = -1;
+    // Player who made an illegal move or -1
+    int forfeited = -1;
+    Move illegalMove = NONE_MOVE;
+    int plies = 0;
+    string finalPosition;
+};
+
+// Houses on random cells which are free at the start
+State arenaStartState(uint64_t seed) {
+    Field start;
+    initializeEntities(start, 0);
+    initializeEntities(start, 1);
+
+    stringstream input;
+    Bitboard houses = 0;
+    for (int count = 0; count < ARENA_HOUSES;) {
+        const int index = (int) (splitMix64(seed) % FIELD_CELLS);
+        if (testBit(start.occupied | houses, index)) continue;
+
+        houses |= cellBit(index);
+        input << Cell::byIndex(index) << ' ';
+        ++count;
+    }
+    input << 0;
+
+    State state;
+    input >> state;
+    return state;
+}
+
+// Moves which the referee accepts from the player to move: its own legal moves, or passing if it has none
+bool isArenaMoveLegal(const State &state, const Move move) {
+    if (move == NONE_MOVE) return allAvailableMoves(state).empty();
+
+    const Field::MoveType type = state.field.checkMove(move);
+    return type != Field::ILLEGAL_MOVE && type != Field::NO_MOVE
+           && state.field.entityAt(move.from).ownerId == state.currentPlayer;
+}
+
+ArenaGame playArenaGame(const ArenaOptions &options, const int game) {
+    ArenaGame result;
+    result.firstPlayer = game % 2;
+
+    State state = arenaStartState(options.seed + (uint64_t) (game / 2) * 0x9E3779B97F4A7C15ull);
+
+    // Engines are created for each game, so that games don't depend on each other
+    unique_ptr<ArenaPlayer> players[2];
+    players[result.firstPlayer].reset(new ArenaPlayer(options.players[0]));
+    players[result.firstPlayer ^ 1].reset(new ArenaPlayer(options.players[1]));
+
+    while (!isGameOver(state)) {
+        const int player = state.currentPlayer;
+
+        State view = state;
+        view.myPlayer = player;
+        const Move move = players[player]->move(view);
+
+        if (!isArenaMoveLegal(state, move)) {
+            result.forfeited = player;
+            result.illegalMove = move;
+            break;
+        }
+
+        state.doMove(move);
+    }
+
+    for (int player = 0; player < 2; ++player) {
+        const Bitboard taken = state.field.houses & state.field.playerEntities[player];
+        result.houses[player] = __builtin_popcountll((uint64_t) taken) + __builtin_popcountll((uint64_t) (taken >> 64));
+    }
+
+    if (result.forfeited >= 0) result.winner = result.forfeited ^ 1;
+    else if (result.houses[0] != result.houses[1]) result.winner = result.houses[0] > result.houses[1] ? 0 : 1;
+
+    result.plies = state.doneSteps;
+    result.finalPosition = toNotation(state);
+    return result;
+}
+
+// Arguments: --games=<count> --threads=<count> --seed=<number> --log=<file>
+// --first=<arguments of the first engine> --second=<arguments of the second engine>, e.g. --first="--depth=4 --hash=4"
+int arenaMain(const int argc, char **argv) {
+    ArenaOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const pair<string, string> argument = splitArgument(argv[i]);
+        const string &name = argument.first,
+                &value = argument.second;
+
+        if (name == "--games") options.games = max(1, stoi(value));
+        else if (name == "--threads") options.threads = max(1, stoi(value));
+        else if (name == "--seed") options.seed = stoull(value);
+        else if (name == "--log") options.log = value;
+        else if (name == "--first" || name == "--second") {
+            stringstream engineArguments(value);
+            string engineArgument;
+            while (engineArguments >> engineArgument) {
+                if (!parseArgument(engineArgument, options.players[name == "--first" ? 0 : 1])) {
+                    cerr << "Unknown engine argument " << engineArgument << endl;
+                    return 2;
+                }
+            }
+        } else cerr << "Unknown argument " << argv[i] << endl;
+    }
+
+    // Games run in parallel, so engines of different games would pin their threads to the same cores
+    for (const Config &player : options.players) {
+        if (player.pinThreads) {
+            cerr << "Engines can't pin threads in the arena" << endl;
+            return 2;
+        }
+    }
+
+    const steady_clock::time_point start = steady_clock::now();
+
+    vector<ArenaGame> games((size_t) options.games);
+    atomic<int> nextGame{0};
+
+    const auto work = [&]() {
+        for (int game = nextGame++; game < options.games; game = nextGame++) games[game] = playArenaGame(options, game);
+    };
+
+    vector<thread> referees;
+    for (int i = 1; i < options.threads; ++i) referees.emplace_back(work);
+    work();
+    for (thread &referee : referees) referee.join();
+
+    const double seconds = duration<double>(steady_clock::now() - start).count();
+
+    // Counted for the first and the second engine
+    int wins[2] = {}, forfeits[2] = {}, draws = 0;
+    uint64_t plies = 0;
+    for (const ArenaGame &game : games) {
+        const int firstPlayer = game.firstPlayer;
+        if (game.winner < 0) ++draws;
+        else ++wins[game.winner == firstPlayer ? 0 : 1];
+        if (game.forfeited >= 0) ++forfeits[game.forfeited == firstPlayer ? 0 : 1];
+        plies += game.plies;
+    }
+
+    const double score = (wins[0] + 0.5 * draws) / options.games;
+    // Adding 0 turns -0 of an even match into 0
+    const double elo = score <= 0 ? -INFINITY : score >= 1 ? INFINITY : -400 * log10(1 / score - 1) + 0.0;
+
+    cout << "games " << options.games << ": first wins " << wins[0] << ", second wins " << wins[1]
+         << ", draws " << draws << ", forfeits " << forfeits[0] << " / " << forfeits[1] << endl;
+    cout << "first scores " << 100 * score << "% (" << showpos << elo << noshowpos << " Elo), "
+         << (double) plies / options.games << " plies per game, " << options.games / seconds << " games/s" << endl;
+
+    if (!options.log.empty()) {
+        ofstream log(options.log);
+        for (size_t i = 0; i < games.size(); ++i) {
+            const ArenaGame &game = games[i];
+            log << "game " << i << ": first plays " << game.firstPlayer << ", houses " << game.houses[0] << ":"
+                << game.houses[1] << ", winner " << game.winner << ", plies " << game.plies;
+            if (game.forfeited >= 0) log << ", illegal move " << game.illegalMove << " by " << game.forfeited;
+            log << ", final " << game.finalPosition << '\n';
+        }
+    }
+
+    return 0;
+}
+#endif
+
+#ifdef REGRESSION
+/******************************************** regression **************************************************************/
+
+/**
+ * Checks of search behaviour which once was wrong. Each check prints its name and ok or the mismatch.
+ */
+static constexpr int REGRESSION_HASH_MEGABYTES = 4;
+
+pair<int, Move> regressionSearch(SearchEngine &engine, const State &state, const int depth) {
+    SearchLimits limits;
+    limits.deadline = steady_clock::now() + hours(1);
+    limits.maxDepth = depth;
+    return engine.search(state, limits);
+}
+
+/**
+ * The same placement a few steps earlier sees more of the game, so its table entries must not be used
+ * when it is searched again closer to the end: results must match the ones with a fresh table.
+ */
+bool checkEndgameTableEntries(const ReferencePosition &position) {
+    Config settings;
+    settings.threads = 1;
+    settings.hashMegabytes = REGRESSION_HASH_MEGABYTES;
+
+    State early = position.state(), late = early;
+    early.doneSteps = MAX_STEPS - 8;
+    late.doneSteps = MAX_STEPS - 4;
+
+    TranspositionTable freshTable(settings.hashMegabytes);
+    unique_ptr<SearchEngine> fresh(createEngine(settings, freshTable));
+    const pair<int, Move> expected = regressionSearch(*fresh, late, 6);
+
+    TranspositionTable warmTable(settings.hashMegabytes);
+    unique_ptr<SearchEngine> warm(createEngine(settings, warmTable));
+    regressionSearch(*warm, early, 8);
+    const pair<int, Move> actual = regressionSearch(*warm, late, 6);
+
+    cout << "endgame table entries, " << position.name << ": ";
+    if (actual == expected) {
+        cout << "ok" << endl;
+        return true;
+    }
+
+    cout << "score " << actual.first << " and move " << actual.second << " instead of " << expected.first
+         << " and " << expected.second << endl;
+    return false;
+}
+
+// Positions in notation where generateMoves once missed moves
+const char *const GENERATOR_POSITIONS[] = {
+        // Moves into an empty taken house, A5-B5 here, were not captures when no free house was near
+        "ac+s+9/cm10/s10t/12/Cx10/12/S10T/1M10/AC+S+8h 0 10 0",
+};
+
+/**
+ * Moves of every stage must be exactly the moves of the player to move which checkMove accepts,
+ * without strongman pushes over a distance, each generated once.
+ */
+bool checkGeneratedMoves(const char *name, const State &state) {
+    const Field &field = state.field;
+
+    // Times each move, from * FIELD_CELLS + to, is generated
+    vector<int> generated(FIELD_CELLS * FIELD_CELLS);
+    for (int stage = 0; stage < STAGES_COUNT; ++stage) {
+        MoveList moves;
+        generateMoves(state, (MoveStage) stage, moves);
+        for (const Move move : moves) ++generated[move.from.index() * FIELD_CELLS + move.to.index()];
+    }
+
+    stringstream mismatches;
+    for (int from = 0; from < FIELD_CELLS; ++from) {
+        for (int to = 0; to < FIELD_CELLS; ++to) {
+            const Move move{Cell::byIndex(from), Cell::byIndex(to)};
+            const Field::MoveType type = field.checkMove(move);
+            const bool longPush = type == Field::PUSH
+                                  && max(abs(move.to.row - move.from.row), abs(move.to.col - move.from.col)) > 1;
+            const bool expected = type != Field::ILLEGAL_MOVE && type != Field::NO_MOVE && !longPush
+                                  && field.cellEntities[from] >> 3 == state.currentPlayer;
+
+            const int count = generated[from * FIELD_CELLS + to];
+            if (count != (int) expected) mismatches << ' ' << move << " generated " << count << " times";
+        }
+    }
+
+    cout << "generated moves, " << name << ":" << (mismatches.str().empty() ? " ok" : mismatches.str()) << endl;
+    return mismatches.str().empty();
+}
+
+// @return 1 if any check fails
+int regressionMain(const int, char **) {
+    bool passed = true;
+    for (const ReferencePosition &position : REFERENCE_POSITIONS) {
+        passed &= checkGeneratedMoves(position.name, position.state());
+    }
+    for (const char *notation : GENERATOR_POSITIONS) {
+        State state;
+        if (!parseNotation(notation, state)) {
+            cout << "malformed position " << notation << endl;
+            return 1;
+        }
+        passed &= checkGeneratedMoves(notation, state);
+    }
+
+    for (const ReferencePosition &position : REFERENCE_POSITIONS) passed &= checkEndgameTableEntries(position);
+
+    return passed ? 0 : 1;
 }
+#endif